@@ -24,6 +24,7 @@
 #include <string_theory/format>
 #include <string_theory/stdio>
 #include <unordered_map>
+#include <algorithm>
 #include <chrono>
 
 std::thread s_authDaemonThread;
@@ -531,12 +532,107 @@ void dm_auth_createAge(Auth_AgeCreate* msg)
     }
 }
 
+/* Players sent to each capacity-limited instance who haven't joined it yet.
+ * The game server only counts players once they have joined, so without
+ * these a burst of links would all be sent to the same instance before any
+ * of them showed up in its population.  Only the daemon thread uses this. */
+static std::unordered_map<DS::Uuid, std::unordered_map<uint32_t,
+        std::chrono::steady_clock::time_point>, DS::UuidHash> s_pendingJoins;
+
+// Long enough for a client to load the link and connect to the game server
+static constexpr std::chrono::seconds PENDING_JOIN_TIMEOUT(60);
+
+uint32_t dm_instance_population(const DS::Uuid& instance)
+{
+    uint32_t population = DS::GameServer_GetNumClients(instance);
+    auto pending = s_pendingJoins.find(instance);
+    if (pending == s_pendingJoins.end())
+        return population;
+
+    const auto now = std::chrono::steady_clock::now();
+    for (auto it = pending->second.begin(); it != pending->second.end(); ) {
+        if (it->second < now || DS::GameServer_HasClient(instance, it->first)) {
+            it = pending->second.erase(it);
+        } else {
+            ++population;
+            ++it;
+        }
+    }
+    if (pending->second.empty())
+        s_pendingJoins.erase(pending);
+    return population;
+}
+
+/* Redirect a link to a full public age to the least populated public
+ * instance of it, or to a brand new one if they're all full.  Private
+ * instances are left alone, and the game server will turn the player away. */
+void dm_auth_spillover(Auth_GameAge* msg, uint32_t capacity)
+{
+    std::vector<Auth_PubAgeRequest::NetAgeInfo> ages;
+    if (!v_find_public_ages(msg->m_name, ages))
+        return;
+
+    auto requested = std::find_if(ages.begin(), ages.end(),
+            [msg](const Auth_PubAgeRequest::NetAgeInfo& age) {
+                return age.m_instance == msg->m_instanceId;
+            });
+    if (requested == ages.end())
+        return;
+
+    const Auth_PubAgeRequest::NetAgeInfo* best = nullptr;
+    uint32_t bestPopulation = capacity;
+    for (const auto& age : ages) {
+        uint32_t population = dm_instance_population(age.m_instance);
+        if (population < bestPopulation) {
+            best = &age;
+            bestPopulation = population;
+        }
+    }
+
+    if (best) {
+        ST::printf("[Auth] {} is full, sending player to {} ({} players)\n",
+                   msg->m_instanceId.toString(true), best->m_instance.toString(true),
+                   bestPopulation);
+        msg->m_instanceId = best->m_instance;
+        return;
+    }
+
+    AuthServer_AgeInfo age;
+    age.m_ageId = gen_uuid();
+    age.m_filename = msg->m_name;
+    age.m_instName = requested->m_instancename;
+    age.m_userName = requested->m_username;
+    age.m_description = requested->m_description;
+    age.m_seqNumber = -1;   // Auto-generate
+    age.m_language = requested->m_language;
+    if (std::get<0>(v_create_age(age, e_AgePublic)) == 0) {
+        ST::printf(stderr, "[Auth] Could not create another {} instance\n", msg->m_name);
+        return;
+    }
+    ST::printf("[Auth] All {} instances are full, opened {}\n", msg->m_name,
+               age.m_ageId.toString(true));
+    msg->m_instanceId = age.m_ageId;
+}
+
 void dm_auth_findAge(Auth_GameAge* msg)
 {
     DEBUG_printf("[Auth] {} Requesting game server {} {}\n",
                  DS::SockIpAddress(msg->m_client->m_sock),
                  msg->m_instanceId.toString(true), msg->m_name);
 
+    uint32_t capacity = DS::GameServer_GetCapacity(msg->m_name);
+    if (capacity) {
+        // A player linking again shouldn't count against themselves
+        const uint32_t playerId = reinterpret_cast<AuthServer_Private*>(msg->m_client)->m_player.m_playerId;
+        for (auto& pending : s_pendingJoins)
+            pending.second.erase(playerId);
+
+        if (dm_instance_population(msg->m_instanceId) >= capacity)
+            dm_auth_spillover(msg, capacity);
+        s_pendingJoins[msg->m_instanceId][playerId] =
+                std::chrono::steady_clock::now() + PENDING_JOIN_TIMEOUT;
+    }
+
     const ST::string instanceIdString = msg->m_instanceId.toString();
     DS::PGresultRef result = DS::PQexecVA(s_postgres,
             "SELECT idx, \"AgeIdx\", \"DisplayName\" FROM game.\"Servers\""
@@ -948,11 +1044,14 @@ void dm_auth_update_globalSDL(Auth_UpdateGlobalSDL* msg)
         return;
     }
 
+    // Game hosts may still be holding the current state, so change a copy
     SDL::State state = it->second;
+    state.detach();
     for (size_t i = 0; i < state.data()->m_simpleVars.size(); ++i) {
         SDL::Variable* var = state.data()->m_simpleVars[i];
         if (var->descriptor()->m_name == msg->m_variable) {
-            var->data()->m_flags |= SDL::Variable::e_HasTimeStamp | SDL::Variable::e_XIsDirty;
+            var->data()->m_flags |= SDL::Variable::e_HasTimeStamp;
+            state.setDirty(var - state.data()->m_vars.data());
             var->data()->m_timestamp.setNow();
 
             if (msg->m_value.empty()) {
@@ -994,7 +1093,8 @@ void dm_auth_update_globalSDL(Auth_UpdateGlobalSDL* msg)
                 // This doesn't block continuing...
             }
 
-            DS::GameServer_UpdateGlobalSDL(msg->m_ageFilename);
+            it->second = state;
+            DS::GameServer_UpdateGlobalSDL(msg->m_ageFilename, state);
             SEND_REPLY(msg, DS::e_NetSuccess);
             return;
         }
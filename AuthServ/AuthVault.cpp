@@ -45,7 +45,8 @@ DS::Uuid gen_uuid()
 
 DS::Blob gen_default_sdl(const ST::string& filename)
 {
-    SDL::StateDescriptor* desc = SDL::DescriptorDb::FindDescriptor(filename, -1);
+    SDL::DescriptorDb::Lease descriptors;
+    SDL::StateDescriptor* desc = descriptors.find(filename, -1);
     if (!desc) {
         ST::printf(stderr, "[Vault] Warning: Could not find SDL descriptor for {}\n",
                    filename);
@@ -239,7 +240,7 @@ bool dm_vault_init()
 
 bool dm_global_sdl_init()
 {
-    return SDL::DescriptorDb::ForLatestDescriptors(v_check_global_sdl);
+    return SDL::DescriptorDb::Lease().forLatest(v_check_global_sdl);
 }
 
 bool dm_all_players_init()
@@ -358,8 +359,7 @@ bool v_check_global_sdl(const ST::string& name, SDL::StateDescriptor* desc)
 
 SDL::State v_find_global_sdl(const ST::string& ageName)
 {
-    SDL::StateDescriptor* desc = SDL::DescriptorDb::FindLatestDescriptor(ageName);
-    if (!desc)
+    if (!SDL::DescriptorDb::Lease().findLatest(ageName))
         return nullptr;
     check_postgres(s_postgres);
 
@@ -0,0 +1,125 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+/* NetMsgStream compression throughput.  Pass captured message payloads
+ * (one raw, uncompressed payload per file) to measure a real corpus;
+ * otherwise a synthetic one is generated.  The one-shot zlib calls that
+ * NetMsgStream used to make are measured alongside as a baseline. */
+
+#include "NetMessages/NetMsgObject.h"
+#include <string_theory/stdio>
+#include <zlib.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <random>
+
+static std::vector<DS::Blob> load_corpus(int argc, char* argv[])
+{
+    std::vector<DS::Blob> corpus;
+    for (int i = 1; i < argc; ++i) {
+        DS::FileStream file;
+        file.open(argv[i], "rb");
+        corpus.emplace_back(file.readBlob(file.size()));
+    }
+    if (!corpus.empty())
+        return corpus;
+
+    // Mostly-repetitive records, roughly like SDL state and notify payloads
+    std::mt19937 rng(42);
+    for (size_t size = 64; size <= 16384; size *= 2) {
+        std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+        for (size_t i = 0; i < size; ++i)
+            data[i] = (i % 16 < 4) ? uint8_t(rng() & 0xFF) : uint8_t(i % 16);
+        corpus.emplace_back(data.get(), size);
+    }
+    return corpus;
+}
+
+template <class func_t>
+static void bench(const char* name, const std::vector<DS::Blob>& corpus,
+                  size_t rounds, func_t func)
+{
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (const DS::Blob& payload : corpus)
+            bytes += func(payload);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    size_t messages = rounds * corpus.size();
+    ST::printf("{<28} {8} ns/msg  {8.1f} MB/s\n", name, elapsed / messages,
+               (bytes / 1048576.0) / (elapsed / 1e9));
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<DS::Blob> corpus = load_corpus(argc, argv);
+    const size_t rounds = 2000;
+
+    // Compressed copies live in shared buffers, as they would when received
+    std::vector<DS::Blob> compressed;
+    for (const DS::Blob& payload : corpus) {
+        DS::BufferStream zstream;
+        MOUL::NetMsgStream::Write(&zstream, MOUL::NetMsgStream::e_CompressZlib,
+                                  payload.buffer(), payload.size());
+        DS::SharedBuffer* shared = DS::SharedBuffer::Create(zstream.size());
+        memcpy(shared->data(), zstream.buffer(), zstream.size());
+        compressed.emplace_back(DS::Blob::Share(shared));
+        shared->unref();
+    }
+
+    bench("compress (one-shot zlib)", corpus, rounds, [](const DS::Blob& payload) {
+        uLongf zlength = compressBound(payload.size() - 2);
+        std::unique_ptr<uint8_t[]> zbuf(new uint8_t[zlength + 2]);
+        memcpy(zbuf.get(), payload.buffer(), 2);
+        compress(zbuf.get() + 2, &zlength, payload.buffer() + 2, payload.size() - 2);
+        return payload.size();
+    });
+
+    DS::BufferStream sink;
+    bench("compress (NetMsgStream)", corpus, rounds, [&sink](const DS::Blob& payload) {
+        sink.truncate();
+        MOUL::NetMsgStream::Write(&sink, MOUL::NetMsgStream::e_CompressZlib,
+                                  payload.buffer(), payload.size());
+        return payload.size();
+    });
+
+    size_t index = 0;
+    bench("decompress (one-shot zlib)", corpus, rounds,
+          [&compressed, &index](const DS::Blob& payload) {
+        // Skip the sizes and compression type, then the raw creatable type
+        const DS::Blob& zblob = compressed[index++ % compressed.size()];
+        std::unique_ptr<uint8_t[]> zbuf(new uint8_t[payload.size()]);
+        uLongf zlength = payload.size() - 2;
+        uncompress(zbuf.get() + 2, &zlength, zblob.buffer() + 11, zblob.size() - 11);
+        return payload.size();
+    });
+
+    index = 0;
+    bench("decompress (NetMsgStream)", corpus, rounds,
+          [&compressed, &index](const DS::Blob& payload) {
+        DS::BlobStream zstream(compressed[index++ % compressed.size()]);
+        MOUL::NetMsgStream msgStream;
+        msgStream.read(&zstream);
+        return payload.size();
+    });
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+/* Parse + write throughput of the hottest game messages.  Build once with
+ * DS_CREATABLE_POOL=ON and once with it OFF to compare the pooled and
+ * heap-allocated paths.  Also compares Creatable::Cast to dynamic_cast. */
+
+#include "NetMessages/NetMsgGameMessage.h"
+#include "NetMessages/NetMsgSDLState.h"
+#include "Messages/AvatarInputStateMsg.h"
+#include "Messages/ServerReplyMsg.h"
+#include "factory.h"
+#include <string_theory/stdio>
+#include <chrono>
+
+static void bench(const char* name, const MOUL::Creatable* proto, size_t iterations)
+{
+    DS::BufferStream source;
+    MOUL::Factory::WriteCreatable(&source, proto);
+
+    DS::BufferStream sink;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        source.seek(0, SEEK_SET);
+        MOUL::Creatable* msg = MOUL::Factory::ReadCreatable(&source);
+        sink.truncate();
+        MOUL::Factory::WriteCreatable(&sink, msg);
+        msg->unref();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    ST::printf("{<24} {10} msgs  {8} ns/msg  {10} msgs/sec\n", name,
+               iterations, elapsed / iterations,
+               uint64_t(iterations * 1000000000.0 / elapsed));
+}
+
+template <class cast_t, class func_t>
+static void bench_cast(const char* name, MOUL::Creatable* obj, size_t iterations,
+                       func_t cast)
+{
+    size_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        cast_t* result = cast(obj);
+        asm volatile("" : : "r"(result));
+        hits += (result != nullptr);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+
+    ST::printf("{<24} {10} casts {8.2f} ns/cast ({} hits)\n", name,
+               iterations, double(elapsed) / iterations, hits);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t iterations = 2000000;
+    if (argc > 1)
+        iterations = strtoul(argv[1], nullptr, 10);
+
+#ifdef DS_NO_CREATABLE_POOL
+    ST::printf("Creatable pooling: off\n");
+#else
+    ST::printf("Creatable pooling: on\n");
+#endif
+
+    MOUL::NetMsgGameMessage* input = MOUL::NetMsgGameMessage::Create();
+    auto inputState = MOUL::AvatarInputStateMsg::Create();
+    inputState->m_state = 0x0042;
+    inputState->m_bcastFlags = MOUL::Message::e_NetPropagate;
+    input->m_message = inputState;
+    bench("AvatarInputStateMsg", input, iterations);
+
+    bench_cast<MOUL::Message>("Cast<Message>", inputState, iterations,
+            [](MOUL::Creatable* obj) { return obj->Cast<MOUL::Message>(); });
+    bench_cast<MOUL::Message>("dynamic_cast<Message>", inputState, iterations,
+            [](MOUL::Creatable* obj) { return dynamic_cast<MOUL::Message*>(obj); });
+    bench_cast<MOUL::NetMessage>("Cast<NetMessage>", inputState, iterations,
+            [](MOUL::Creatable* obj) { return obj->Cast<MOUL::NetMessage>(); });
+    bench_cast<MOUL::NetMessage>("dynamic_cast<NetMessage>", inputState, iterations,
+            [](MOUL::Creatable* obj) { return dynamic_cast<MOUL::NetMessage*>(obj); });
+    input->unref();
+
+    MOUL::NetMsgGameMessage* reply = MOUL::NetMsgGameMessage::Create();
+    auto replyMsg = MOUL::ServerReplyMsg::Create();
+    replyMsg->m_reply = MOUL::ServerReplyMsg::e_Affirm;
+    reply->m_message = replyMsg;
+    bench("ServerReplyMsg", reply, iterations);
+    reply->unref();
+
+    MOUL::NetMsgSDLStateBCast* state = MOUL::NetMsgSDLStateBCast::Create();
+    uint8_t sdlData[64] = {};
+    state->m_sdlBlob = DS::Blob(sdlData, sizeof(sdlData));
+    bench("NetMsgSDLStateBCast", state, iterations);
+    state->unref();
+
+    return 0;
+}
@@ -0,0 +1,315 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+/* SDL descriptor loading, and SDL::State parse, serialize and merge
+ * throughput and heap allocations.
+ *
+ *   bench_sdl [sdl dir [blob dir]]
+ *
+ * Pass a directory of .sdl files (such as a shard's SDL folder) to measure
+ * the latest version of every real descriptor; otherwise a synthetic
+ * age-like descriptor is generated.  Every variable is given a non-default
+ * value, so the blobs are as large as the descriptors allow.  Optionally,
+ * a directory of raw state blobs (as saved in the vault) can be given to
+ * measure those instead. */
+
+#include "SDL/DescriptorDb.h"
+#include <string_theory/format>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+
+static std::atomic<size_t> s_allocations;
+
+void* operator new(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+static ST::string write_synthetic_sdl()
+{
+    char tempDir[] = "/tmp/DirtSandSDLBenchXXXXXX";
+    if (!mkdtemp(tempDir))
+        return ST::string();
+
+    ST::string_stream sdl;
+    sdl << "STATEDESC BenchAge\n{\n    VERSION 7\n";
+    for (int i = 0; i < 60; ++i)
+        sdl << ST::format("    VAR BOOL    bVar{}[1]    DEFAULT=0\n", i);
+    for (int i = 0; i < 30; ++i)
+        sdl << ST::format("    VAR INT     iVar{}[1]    DEFAULT=0\n", i);
+    for (int i = 0; i < 20; ++i)
+        sdl << ST::format("    VAR BYTE    yVar{}[1]    DEFAULT=0\n", i);
+    for (int i = 0; i < 8; ++i)
+        sdl << ST::format("    VAR FLOAT   fVar{}[4]    DEFAULT=0\n", i);
+    sdl << "    VAR STRING32 sVar[2]    DEFAULT=\"\"\n";
+    sdl << "    VAR POINT3  pVar[3]\n";
+    sdl << "    VAR INT     iList[]\n";
+    sdl << "}\n";
+
+    ST::string filename = ST::format("{}/BenchAge.sdl", tempDir);
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file)
+        return ST::string();
+    ST::string text = sdl.to_string();
+    fwrite(text.c_str(), 1, text.size(), file);
+    fclose(file);
+    return filename;
+}
+
+static void fill_state(SDL::State& state)
+{
+    for (SDL::Variable& var : state.data()->m_vars) {
+        auto* data = var.data();
+        for (size_t i = 0; i < data->m_size; ++i) {
+            switch (var.descriptor()->m_type) {
+            case SDL::e_VarBool:
+                data->m_bool[i] = true;
+                break;
+            case SDL::e_VarInt:
+                data->m_int[i] = 1000 + i;
+                break;
+            case SDL::e_VarByte:
+                data->m_byte[i] = 1 + i;
+                break;
+            case SDL::e_VarShort:
+                data->m_short[i] = 100 + i;
+                break;
+            case SDL::e_VarFloat:
+                data->m_float[i] = 0.5f + i;
+                break;
+            case SDL::e_VarDouble:
+                data->m_double[i] = 0.25 + i;
+                break;
+            case SDL::e_VarString:
+                data->m_string[i] = ST_LITERAL("Relto");
+                break;
+            case SDL::e_VarVector3:
+            case SDL::e_VarPoint3:
+                data->m_vector[i].m_X = 1.0f + i;
+                break;
+            default:
+                break;
+            }
+        }
+        data->m_flags &= ~SDL::Variable::e_SameAsDefault;
+    }
+    for (size_t i = 0; i < state.data()->m_vars.size(); ++i)
+        state.setDirty(i);
+}
+
+// Reports the best of several runs, since a single run is easily skewed
+// by other load on the machine
+template <class func_t>
+static void bench(const char* name, const std::vector<DS::Blob>& corpus,
+                  size_t rounds, func_t func)
+{
+    size_t bytes = 0, allocations = 0;
+    int64_t best = INT64_MAX;
+    for (int run = 0; run < 5; ++run) {
+        bytes = 0;
+        allocations = s_allocations.load(std::memory_order_relaxed);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (const DS::Blob& blob : corpus)
+                bytes += func(blob);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        best = std::min<int64_t>(best, elapsed);
+        allocations = s_allocations.load(std::memory_order_relaxed) - allocations;
+    }
+
+    size_t states = rounds * corpus.size();
+    ST::printf("{<28} {8} ns/state  {8.1f} MB/s  {6.1f} allocs/state\n", name,
+               best / states, (bytes / 1048576.0) / (best / 1e9),
+               double(allocations) / states);
+}
+
+static bool bench_load(const char* name, const ST::string& sdlpath,
+                       const ST::string& cachefile)
+{
+    int64_t best = INT64_MAX;
+    for (int run = 0; run < 5; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        if (!SDL::DescriptorDb::LoadDescriptors(sdlpath.c_str(), cachefile))
+            return false;
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        best = std::min<int64_t>(best, elapsed);
+    }
+    ST::printf("{<28} {8} us\n", name, best);
+    return true;
+}
+
+static std::vector<DS::Blob> read_blobs(const char* path)
+{
+    std::vector<DS::Blob> blobs;
+    DIR* dir = opendir(path);
+    if (!dir)
+        return blobs;
+
+    while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.')
+            continue;
+        ST::string filename = ST::format("{}/{}", path, entry->d_name);
+        FILE* file = fopen(filename.c_str(), "rb");
+        if (!file)
+            continue;
+        std::vector<uint8_t> data;
+        uint8_t buffer[4096];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            data.insert(data.end(), buffer, buffer + count);
+        fclose(file);
+        if (!data.empty())
+            blobs.emplace_back(data.data(), data.size());
+    }
+    closedir(dir);
+    return blobs;
+}
+
+int main(int argc, char* argv[])
+{
+    ST::string sdlpath, filename;
+    if (argc > 1) {
+        sdlpath = argv[1];
+    } else {
+        filename = write_synthetic_sdl();
+        sdlpath = filename.before_last('/');
+    }
+
+    char cacheDir[] = "/tmp/DirtSandSDLCacheXXXXXX";
+    bool haveCacheDir = mkdtemp(cacheDir) != nullptr;
+    ST::string cachefile = ST::format("{}/sdl.cache", cacheDir);
+
+    // The first cached load has nothing to read, and writes the cache
+    bool loaded = (argc > 1 || !filename.empty()) && haveCacheDir
+               && bench_load("LoadDescriptors (parse)", sdlpath, ST::string())
+               && SDL::DescriptorDb::LoadDescriptors(sdlpath.c_str(), cachefile)
+               && bench_load("LoadDescriptors (cache)", sdlpath, cachefile);
+    if (haveCacheDir) {
+        unlink(cachefile.c_str());
+        rmdir(cacheDir);
+    }
+    if (!filename.empty()) {
+        unlink(filename.c_str());
+        rmdir(sdlpath.c_str());
+    }
+    if (!loaded) {
+        fputs("Could not load SDL descriptors\n", stderr);
+        return 1;
+    }
+
+    std::vector<DS::Blob> corpus;
+    std::vector<SDL::State> states;
+    if (argc > 2) {
+        for (DS::Blob& blob : read_blobs(argv[2])) {
+            try {
+                SDL::State state = SDL::State::FromBlob(blob);
+                if (state.descriptor()) {
+                    corpus.emplace_back(std::move(blob));
+                    states.emplace_back(state);
+                }
+            } catch (const std::exception&) {
+                // Not a state we have a descriptor for
+            }
+        }
+    } else {
+        SDL::DescriptorDb::Lease().forLatest([&](const ST::string&, SDL::StateDescriptor* desc) {
+            SDL::State state(desc);
+            fill_state(state);
+            corpus.emplace_back(state.toBlob());
+            states.emplace_back(SDL::State::FromBlob(corpus.back()));
+            return true;
+        });
+    }
+    if (corpus.empty()) {
+        fputs("No SDL states to measure\n", stderr);
+        return 1;
+    }
+
+    // Typical updates from clients only change one or two variables
+    std::vector<SDL::State> updates, bases;
+    for (const SDL::State& state : states) {
+        SDL::StateDescriptor* desc = state.descriptor();
+        SDL::State update(desc);
+        if (!desc->m_vars.empty()) {
+            update.setDirty(desc->m_vars.size() - 1);
+            update.data()->m_vars.back().data()->m_timestamp.setNow();
+        }
+        updates.emplace_back(update);
+        bases.emplace_back(desc);
+    }
+
+    size_t totalBytes = 0;
+    for (const DS::Blob& blob : corpus)
+        totalBytes += blob.size();
+    ST::printf("{} states, {} bytes\n", corpus.size(), totalBytes);
+
+    const size_t rounds = std::max<size_t>(1, 5000000 / totalBytes);
+
+    bench("State::FromBlob", corpus, rounds, [](const DS::Blob& blob) {
+        SDL::State state = SDL::State::FromBlob(blob);
+        return blob.size();
+    });
+
+    size_t index = 0;
+    bench("State::toBlob", corpus, rounds, [&states, &index](const DS::Blob& blob) {
+        DS::Blob out = states[index++ % states.size()].toBlob();
+        return out.size();
+    });
+
+    index = 0;
+    bench("State::add (1 var)", corpus, rounds, [&](const DS::Blob& blob) {
+        size_t i = index++ % updates.size();
+        bases[i].add(updates[i]);
+        return blob.size();
+    });
+
+    index = 0;
+    bench("State::merge (1 var)", corpus, rounds, [&](const DS::Blob& blob) {
+        size_t i = index++ % updates.size();
+        bases[i].merge(updates[i]);
+        return blob.size();
+    });
+
+    index = 0;
+    bench("State::isDirty", corpus, rounds, [&](const DS::Blob& blob) {
+        return updates[index++ % updates.size()].isDirty() ? blob.size() : 0;
+    });
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+/* Stands in for libFuzzer's main() when it isn't available.  Each file
+ * given on the command line is run through the target once. */
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv);
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+int main(int argc, char* argv[])
+{
+    LLVMFuzzerInitialize(&argc, &argv);
+    for (int i = 1; i < argc; ++i) {
+        FILE* file = fopen(argv[i], "rb");
+        if (!file) {
+            fprintf(stderr, "Could not open %s\n", argv[i]);
+            return 1;
+        }
+        std::vector<uint8_t> data;
+        uint8_t buffer[4096];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            data.insert(data.end(), buffer, buffer + count);
+        fclose(file);
+
+        fprintf(stderr, "Running %s (%zu bytes)\n", argv[i], data.size());
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+/* Fuzzes SDL::State::FromBlob, which parses the SDL blobs clients send to
+ * game servers.  Set DS_FUZZ_SDL_PATH to a directory of .sdl files to use
+ * real descriptors; otherwise a small set covering every variable type is
+ * used.  Blobs which parse are also combined with another state, and must
+ * survive being written out and parsed again. */
+
+#include "SDL/DescriptorDb.h"
+#include <string_theory/format>
+#include <cstdlib>
+#include <unistd.h>
+
+static const char s_descriptors[] = R"(
+STATEDESC FuzzChild
+{
+    VERSION 1
+    VAR INT         iValue[1]   DEFAULT=0
+    VAR STRING32    sName[1]    DEFAULT=""
+}
+
+STATEDESC FuzzAge
+{
+    VERSION 1
+    VAR BOOL        bVar[1]     DEFAULT=0
+    VAR INT         iVar[2]     DEFAULT=0
+    VAR BYTE        yVar[1]     DEFAULT=0
+    VAR SHORT       hVar[1]     DEFAULT=0
+    VAR FLOAT       fVar[1]     DEFAULT=0
+    VAR DOUBLE      dVar[1]     DEFAULT=0
+    VAR TIME        tVar[1]
+    VAR STRING32    sVar[1]     DEFAULT=""
+    VAR PLKEY       kVar[1]
+    VAR CREATABLE   mVar[1]
+    VAR POINT3      pVar[1]
+    VAR VECTOR3     vVar[1]
+    VAR QUATERNION  qVar[1]
+    VAR RGB         cVar[1]
+    VAR RGBA8       aVar[1]
+    VAR AGETIMEOFDAY tod[1]
+    VAR INT         iList[]
+    VAR $FuzzChild  child[2]
+    VAR $FuzzChild  children[]
+}
+)";
+
+static bool load_builtin_descriptors()
+{
+    char tempDir[] = "/tmp/DirtSandSDLFuzzXXXXXX";
+    if (!mkdtemp(tempDir))
+        return false;
+
+    ST::string filename = ST::format("{}/Fuzz.sdl", tempDir);
+    bool loaded = false;
+    if (FILE* file = fopen(filename.c_str(), "w")) {
+        fputs(s_descriptors, file);
+        fclose(file);
+        loaded = SDL::DescriptorDb::LoadDescriptors(tempDir);
+        unlink(filename.c_str());
+    }
+    rmdir(tempDir);
+    return loaded;
+}
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    const char* sdlPath = getenv("DS_FUZZ_SDL_PATH");
+    bool loaded = sdlPath ? SDL::DescriptorDb::LoadDescriptors(sdlPath)
+                          : load_builtin_descriptors();
+    if (!loaded) {
+        fputs("Could not load SDL descriptors\n", stderr);
+        abort();
+    }
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    DS::Blob blob(data, size);
+    SDL::State state;
+    try {
+        state = SDL::State::FromBlob(blob);
+    } catch (const std::exception&) {
+        // Rejecting bad data is fine, as long as it doesn't crash
+        return 0;
+    }
+    if (!state.descriptor())
+        return 0;
+
+    SDL::State other(state.descriptor());
+    other.add(state);
+    other.merge(state);
+
+    // Anything we accepted must be written back out in a form we accept
+    DS::Blob written = state.toBlob();
+    try {
+        SDL::State::FromBlob(written);
+    } catch (const std::exception& ex) {
+        fprintf(stderr, "Could not parse a rewritten blob: %s\n", ex.what());
+        abort();
+    }
+    return 0;
+}
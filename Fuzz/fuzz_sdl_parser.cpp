@@ -0,0 +1,62 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+/* Fuzzes SDL::Parser with arbitrary .sdl file contents, including the
+ * encrypted formats it detects from the file header. */
+
+#include "SDL/SdlParser.h"
+#include "SDL/DescriptorDb.h"
+#include <cstdlib>
+#include <unistd.h>
+
+static char s_filename[] = "/tmp/DirtSandSDLFuzzXXXXXX";
+
+static void remove_input()
+{
+    unlink(s_filename);
+}
+
+extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv)
+{
+    // The parser only reads from files
+    int fd = mkstemp(s_filename);
+    if (fd < 0) {
+        perror("Could not create a file for fuzz inputs");
+        abort();
+    }
+    close(fd);
+    atexit(remove_input);
+    return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    FILE* file = fopen(s_filename, "wb");
+    if (!file)
+        abort();
+    fwrite(data, 1, size, file);
+    fclose(file);
+
+    SDL::Parser parser;
+    if (!parser.open(s_filename))
+        return 0;
+    try {
+        parser.parse();
+    } catch (const std::exception&) {
+        // Rejecting bad data is fine, as long as it doesn't crash
+    }
+    return 0;
+}
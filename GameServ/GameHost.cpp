@@ -26,14 +26,25 @@
 #include "PlasMOUL/Messages/ServerReplyMsg.h"
 #include "PlasMOUL/Messages/LoadAvatarMsg.h"
 #include "SDL/DescriptorDb.h"
+#include "MsgStats.h"
 #include "settings.h"
 #include "errors.h"
 #include <string_theory/codecs>
 #include <string_theory/format>
+#include <unistd.h>
 
 hostmap_t s_gameHosts;
 std::mutex s_gameHostMutex;
+std::condition_variable s_gameHostClosed;
 agemap_t s_ages;
+DS::ThreadPool* s_gameHostPool = nullptr;
+DS::PostgresPool* s_gameDbPool = nullptr;
+
+Game_AgeInfo find_age_info(const ST::string& ageFilename)
+{
+    auto age_iter = s_ages.find(ageFilename);
+    return (age_iter != s_ages.end()) ? age_iter->second : Game_AgeInfo();
+}
 
 #define SEND_REPLY(msg, result) \
     msg->m_client->m_channel.putMessage(result)
@@ -53,12 +64,220 @@ agemap_t s_ages;
     _msgbuf->seek(4, SEEK_SET); \
     _msgbuf->write<uint32_t>(_msgbuf->size() - 8)
 
+// Like DM_SENDBUF, but drops an unsent message with the same key first
+#define DM_SENDBUF_COALESCED(client, key) \
+    _msgbuf->ref(); \
+    if (void* _stale = client->m_broadcast.putOrReplace(e_GameToCli_PropagateBuffer, _msgbuf, key)) \
+        reinterpret_cast<DS::BufferStream*>(_stale)->unref()
+
 #define DM_SENDMSG(msg, client) \
     DM_WRITEBUF(msg); \
     client->m_broadcast.putMessage(e_GameToCli_PropagateBuffer, _msgbuf)
 
-void dm_game_shutdown(GameHost_Private* host)
+DS::FifoMessage dm_auth_reply(AuthClient_Private& fakeClient)
+{
+    // The auth daemon may in turn be waiting on another host, so don't
+    // let it starve for a worker thread while we wait here.
+    DS::ThreadPool::BlockingScope blocking;
+    return fakeClient.m_channel.getMessage();
+}
+
+void dm_invalidate_state(GameHost_Private* host)
 {
+    for (DS::BufferStream* buf : host->m_initialState)
+        buf->unref();
+    host->m_initialState.clear();
+}
+
+static const uint32_t HIBERNATE_MAGIC = 0x42484244;   // "DBHB"
+static const uint32_t HIBERNATE_VERSION = 2;
+
+ST::string hibernate_filename(uint32_t serverIdx)
+{
+    return ST::format("{}/{}.hib", DS::Settings::GameHibernatePath(), serverIdx);
+}
+
+/* Identifies the version of an age's rows in the AgeStates table.  Every
+ * insert or update gives a row a newer transaction id (xmin), and deletes
+ * change the count, so a snapshot taken with the same values is still
+ * what the database holds. */
+struct AgeStatesVersion
+{
+    uint64_t m_count, m_lastXid;
+
+    bool operator==(const AgeStatesVersion& other) const
+    {
+        return m_count == other.m_count && m_lastXid == other.m_lastXid;
+    }
+};
+
+bool dm_age_states_version(GameHost_Private* host, AgeStatesVersion& version)
+{
+    DS::PostgresPool::Lease postgres(s_gameDbPool);
+    if (!postgres)
+        return false;
+
+    DS::PGresultRef result = DS::PQexecVA(postgres,
+            "SELECT count(*), COALESCE(max(xmin::text::bigint), 0)"
+            "    FROM game.\"AgeStates\" WHERE \"ServerIdx\"=$1",
+            host->m_serverIdx);
+    if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+        PQ_PRINT_ERROR(postgres, SELECT);
+        return false;
+    }
+    version.m_count = strtoull(PQgetvalue(result, 0, 0), nullptr, 10);
+    version.m_lastXid = strtoull(PQgetvalue(result, 0, 1), nullptr, 10);
+    return true;
+}
+
+void dm_hibernate(GameHost_Private* host)
+{
+    if (DS::Settings::GameHibernatePath().empty() || host->m_temp)
+        return;
+
+    // Only the persistent states are snapshotted, which is exactly what
+    // would otherwise be reloaded from the AgeStates table.
+    uint32_t count = 0;
+    for (const auto& object : host->m_states) {
+        for (const auto& state : object.second)
+            count += state.second.m_persist ? 1 : 0;
+    }
+
+    // Every change was already saved, so this is what a restore will
+    // expect to find in the database
+    AgeStatesVersion version;
+    if (!dm_age_states_version(host, version))
+        return;
+
+    ST::string filename = hibernate_filename(host->m_serverIdx);
+    ST::string tempname = filename + ".tmp";
+    try {
+        DS::FileStream stream;
+        stream.open(tempname.c_str(), "wb");
+        stream.write<uint32_t>(HIBERNATE_MAGIC);
+        stream.write<uint32_t>(HIBERNATE_VERSION);
+        host->m_instanceId.write(&stream);
+        stream.write<uint64_t>(version.m_count);
+        stream.write<uint64_t>(version.m_lastXid);
+        stream.write<uint32_t>(count);
+        for (auto& object : host->m_states) {
+            for (auto& state : object.second) {
+                if (!state.second.m_persist)
+                    continue;
+                if (!state.second.m_blob.size())
+                    state.second.m_blob = state.second.m_state.toBlob();
+                object.first.write(&stream);
+                stream.writeSafeString(state.second.m_state.descriptor()->m_name);
+                stream.write<uint32_t>(state.second.m_blob.size());
+                stream.writeBytes(state.second.m_blob.buffer(), state.second.m_blob.size());
+            }
+        }
+        stream.close();
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Game] Error hibernating {}: {}\n", filename, ex.what());
+        unlink(tempname.c_str());
+        return;
+    }
+
+    // Make sure a half-written snapshot can never be picked up
+    if (rename(tempname.c_str(), filename.c_str()) < 0) {
+        ST::printf(stderr, "[Game] Error hibernating {}: {}\n", filename,
+                   strerror(errno));
+        unlink(tempname.c_str());
+    }
+}
+
+bool dm_restore(GameHost_Private* host)
+{
+    if (DS::Settings::GameHibernatePath().empty())
+        return false;
+
+    // Snapshots are single-use: once the host is running again, the
+    // database is the authoritative copy.  Renaming it away first means
+    // only one host can claim it, even if two start for the same age.
+    // The claimed name still ends in .hib, so startup cleans it up if we
+    // never get to.
+    ST::string filename = hibernate_filename(host->m_serverIdx);
+    ST::string claimed = ST::format("{}/{}.{}.claimed.hib", DS::Settings::GameHibernatePath(),
+                                    host->m_serverIdx, reinterpret_cast<uintptr_t>(host));
+    if (rename(filename.c_str(), claimed.c_str()) < 0) {
+        if (errno != ENOENT)
+            ST::printf(stderr, "[Game] Error claiming {}: {}\n", filename, strerror(errno));
+        return false;
+    }
+    DS::FileStream stream;
+    try {
+        stream.open(claimed.c_str(), "rb");
+    } catch (const DS::FileIOException& ex) {
+        ST::printf(stderr, "[Game] Error restoring {}: {}\n", filename, ex.what());
+        unlink(claimed.c_str());
+        return false;
+    }
+    unlink(claimed.c_str());
+
+    try {
+        if (stream.read<uint32_t>() != HIBERNATE_MAGIC
+                || stream.read<uint32_t>() != HIBERNATE_VERSION)
+            throw DS::FileIOException("Unsupported snapshot format");
+        DS::Uuid instanceId;
+        instanceId.read(&stream);
+        if (instanceId != host->m_instanceId)
+            throw DS::FileIOException("Snapshot is for a different age instance");
+
+        // Something else may have written the age's states since, such as
+        // upgradesdl or an administrator
+        AgeStatesVersion saved, current;
+        saved.m_count = stream.read<uint64_t>();
+        saved.m_lastXid = stream.read<uint64_t>();
+        if (!dm_age_states_version(host, current))
+            throw DS::FileIOException("Could not check the database for newer states");
+        if (!(saved == current))
+            throw DS::FileIOException("The database has newer states");
+
+        uint32_t count = stream.read<uint32_t>();
+        for (uint32_t i = 0; i < count; ++i) {
+            MOUL::Uoid key;
+            key.read(&stream);
+            stream.readSafeString();    // Descriptor name, which the blob has too
+            uint32_t size = stream.read<uint32_t>();
+            std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+            if (stream.readBytes(buffer.get(), size) != static_cast<ssize_t>(size))
+                throw DS::EofException();
+            DS::Blob sdlblob = DS::Blob::Steal(buffer.release(), size);
+
+            GameState gs;
+            gs.m_isAvatar = false;
+            gs.m_persist = true;
+            gs.m_state = SDL::State::FromBlob(sdlblob);
+            if (!gs.m_state.descriptor())
+                throw DS::FileIOException("Unknown SDL descriptor");
+            if (!gs.m_state.update())
+                gs.m_blob = std::move(sdlblob);
+            host->m_states[key][gs.m_state.descriptor()->m_id] = std::move(gs);
+        }
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Game] Error restoring {}: {}\n", filename, ex.what());
+        host->m_states.clear();
+        return false;
+    }
+    return true;
+}
+
+/* Stop accepting players and kick out those still here.  Their client
+ * threads detach as they notice, and the last one out queues e_GameClose.
+ * If idleOnly is set, this is only done if nobody has attached since the
+ * host went idle. */
+void dm_game_shutdown(GameHost_Private* host, bool idleOnly)
+{
+    bool detached;
+    {
+        std::lock_guard<std::mutex> queueGuard(host->m_queueMutex);
+        if (host->m_state != e_HostRunning || (idleOnly && host->m_attached != 0))
+            return;
+        host->m_state = e_HostDraining;
+        detached = (host->m_attached == 0);
+    }
+
     {
         std::lock_guard<std::mutex> clientGuard(host->m_clientMutex);
         for (auto client_iter = host->m_clients.begin(); client_iter != host->m_clients.end(); ++client_iter)
@@ -68,43 +287,66 @@ void dm_game_shutdown(GameHost_Private* host)
     for (auto clone_iter = host->m_clones.begin(); clone_iter != host->m_clones.end(); ++clone_iter)
         clone_iter->second->unref();
     host->m_clones.clear();
+    dm_invalidate_state(host);
 
-    bool complete = false;
-    for (int i=0; i<50 && !complete; ++i) {
-        host->m_clientMutex.lock();
-        size_t alive = host->m_clients.size();
-        host->m_clientMutex.unlock();
-        if (alive == 0)
-            complete = true;
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-    if (!complete)
-        fputs("[Game] Clients didn't die after 5 seconds!\n", stderr);
-
-    s_gameHostMutex.lock();
-    hostmap_t::iterator host_iter = s_gameHosts.begin();
-    while (host_iter != s_gameHosts.end()) {
-        if (host_iter->second == host)
-            host_iter = s_gameHosts.erase(host_iter);
-        else
-            ++host_iter;
+    if (detached)
+        post_game_host(host, e_GameClose);
+}
+
+/* Save what's left of the host and free it.  Only ever queued once every
+ * client thread has detached, so nothing else can be holding the host
+ * except server-wide updates, which go through s_gameHostMutex. */
+void dm_game_close(GameHost_Private* host)
+{
+    std::queue<DS::FifoMessage> leftover;
+    {
+        std::lock_guard<std::mutex> queueGuard(host->m_queueMutex);
+        host->m_state = e_HostClosing;
+        leftover.swap(host->m_queue);
+    }
+    while (!leftover.empty()) {
+        if (leftover.front().m_messageType == e_GameLocalSdlUpdate) {
+            SEND_REPLY(reinterpret_cast<Game_SdlMessage*>(leftover.front().m_payload),
+                       DS::e_NetRemoteShutdown);
+        } else if (leftover.front().m_messageType == e_GameGlobalSdlUpdate) {
+            delete reinterpret_cast<SDL::State*>(leftover.front().m_payload);
+        }
+        leftover.pop();
     }
-    s_gameHostMutex.unlock();
+
+    // This must happen while the host is still registered, or a new host
+    // for this age could start from the database before the snapshot exists
+    dm_hibernate(host);
+
+    {
+        std::lock_guard<std::mutex> hostGuard(s_gameHostMutex);
+        hostmap_t::iterator host_iter = s_gameHosts.begin();
+        while (host_iter != s_gameHosts.end()) {
+            if (host_iter->second == host)
+                host_iter = s_gameHosts.erase(host_iter);
+            else
+                ++host_iter;
+        }
+    }
+    s_gameHostClosed.notify_all();
 
     if (host->m_temp) {
-        DS::PQexecVA(host->m_postgres,
-                     "DELETE FROM game.\"Servers\" "
-                     "    WHERE \"idx\"=$1",
-                     host->m_serverIdx);
+        DS::PostgresPool::Lease postgres(s_gameDbPool);
+        if (postgres) {
+            DS::PQexecVA(postgres,
+                         "DELETE FROM game.\"Servers\" "
+                         "    WHERE \"idx\"=$1",
+                         host->m_serverIdx);
+        }
     }
-    PQfinish(host->m_postgres);
     delete host;
 }
 
-void dm_broadcast(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender)
+size_t dm_broadcast(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender)
 {
     DM_WRITEBUF(msg);
 
+    size_t sent = 0;
     std::lock_guard<std::mutex> hostGuard(s_gameHostMutex);
     for (auto host_it = s_gameHosts.begin(); host_it != s_gameHosts.end(); ++host_it) {
         std::lock_guard<std::mutex> clientGuard(host_it->second->m_clientMutex);
@@ -113,32 +355,63 @@ void dm_broadcast(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender
                 && !(msg->m_contentFlags & MOUL::NetMessage::e_EchoBackToSender))
                 continue;
             DM_SENDBUF(client_it->second);
+            ++sent;
         }
     }
 
     DM_UNREFBUF();
+    return sent;
 }
 
-void dm_propagate(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender)
+// Avatar input state is resent every time a player changes direction or
+// speed, and only the most recent one matters to a client which hasn't
+// received the previous one yet.  Returns 0 for messages which must all
+// be delivered.
+uint64_t dm_coalesce_key(MOUL::NetMessage* msg, uint32_t sender)
+{
+    if (!DS::Settings::GameCoalesceMovement())
+        return 0;
+
+    MOUL::NetMsgGameMessage* gameMsg = msg->Cast<MOUL::NetMsgGameMessage>();
+    if (!gameMsg || !gameMsg->m_message)
+        return 0;
+    switch (gameMsg->m_message->type()) {
+    case MOUL::ID_AvatarInputStateMsg:
+        return (static_cast<uint64_t>(gameMsg->m_message->type()) << 32) | sender;
+    default:
+        return 0;
+    }
+}
+
+size_t dm_propagate(GameHost_Private* host, MOUL::NetMessage* msg, uint32_t sender)
 {
     DM_WRITEBUF(msg);
+    uint64_t coalesceKey = dm_coalesce_key(msg, sender);
 
+    size_t sent = 0;
     std::lock_guard<std::mutex> clientGuard(host->m_clientMutex);
     for (auto client_iter = host->m_clients.begin(); client_iter != host->m_clients.end(); ++client_iter) {
         if (client_iter->second->m_clientInfo.m_PlayerId == sender
             && !(msg->m_contentFlags & MOUL::NetMessage::e_EchoBackToSender))
             continue;
-        DM_SENDBUF(client_iter->second);
+        if (coalesceKey) {
+            DM_SENDBUF_COALESCED(client_iter->second, coalesceKey);
+        } else {
+            DM_SENDBUF(client_iter->second);
+        }
+        ++sent;
     }
 
     DM_UNREFBUF();
+    return sent;
 }
 
-void dm_propagate_to(GameHost_Private* host, MOUL::NetMessage* msg,
-                     const std::vector<uint32_t>& receivers)
+size_t dm_propagate_to(GameHost_Private* host, MOUL::NetMessage* msg,
+                       const std::vector<uint32_t>& receivers)
 {
     DM_WRITEBUF(msg);
 
+    size_t sent = 0;
     for (auto rcvr_iter = receivers.begin(); rcvr_iter != receivers.end(); ++rcvr_iter) {
         std::lock_guard<std::mutex> hostGuard(s_gameHostMutex);
         for (hostmap_t::iterator recv_host = s_gameHosts.begin(); recv_host != s_gameHosts.end(); ++recv_host) {
@@ -146,12 +419,76 @@ void dm_propagate_to(GameHost_Private* host, MOUL::NetMessage* msg,
             auto client = recv_host->second->m_clients.find(*rcvr_iter);
             if (client != recv_host->second->m_clients.end()) {
                 DM_SENDBUF(client->second);
+                ++sent;
                 break; // Don't bother checking the rest of the hosts, we found the one we're looking for
             }
         }
     }
 
     DM_UNREFBUF();
+    return sent;
+}
+
+/* Runs on the sender's client thread instead of the host's, so voice isn't
+ * queued behind SDL and state traffic.  The message is only parsed to
+ * validate it; receivers get the sender's bytes as they were.  Unlike
+ * directed game messages, voice only reaches players in the same age. */
+void relay_voice(GameHost_Private* host, Game_PropagateMessage* msg)
+{
+    bool measure = msg->m_received != std::chrono::steady_clock::time_point();
+    std::chrono::steady_clock::time_point parseStart;
+    if (measure)
+        parseStart = std::chrono::steady_clock::now();
+
+    DS::BlobStream stream(msg->m_message);
+    MOUL::NetMsgVoice* voice = nullptr;
+    try {
+        voice = MOUL::Factory::Read<MOUL::NetMsgVoice>(&stream);
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[Game] Exception reading voice message: {}\n", ex.what());
+        return;
+    }
+    if (!voice) {
+        fputs("[Game] Warning: Ignoring voice message of the wrong type\n", stderr);
+        return;
+    }
+    if (!stream.atEof()) {
+        ST::printf(stderr, "[Game] Incomplete parse of {04X}\n", voice->type());
+        voice->unref();
+        return;
+    }
+
+    uint64_t parseNsec = 0;
+    if (measure) {
+        parseNsec = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - parseStart).count();
+    }
+
+    DS::BufferStream* _msgbuf = new DS::BufferStream();
+    _msgbuf->write<uint32_t>(voice->type());
+    _msgbuf->write<uint32_t>(msg->m_message.size());
+    _msgbuf->writeBytes(msg->m_message.buffer(), msg->m_message.size());
+
+    size_t sent = 0;
+    {
+        std::lock_guard<std::mutex> clientGuard(host->m_clientMutex);
+        for (uint32_t receiver : voice->m_receivers) {
+            auto client = host->m_clients.find(receiver);
+            if (client != host->m_clients.end()) {
+                DM_SENDBUF(client->second);
+                ++sent;
+            }
+        }
+    }
+    DM_UNREFBUF();
+
+    if (measure) {
+        uint64_t latencyUsec = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - msg->m_received).count();
+        DS::MsgStats_Record(voice->type(), msg->m_message.size(), parseNsec, sent,
+                            latencyUsec);
+    }
+    voice->unref();
 }
 
 void dm_local_sdl_update(GameHost_Private* host, DS::Blob blob)
@@ -163,7 +500,7 @@ void dm_local_sdl_update(GameHost_Private* host, DS::Blob blob)
     sdlNode.m_node.set_NodeIdx(host->m_sdlIdx);
     sdlNode.m_node.set_Blob_1(std::move(blob));
     s_authChannel.putMessage(e_VaultUpdateNode, reinterpret_cast<void*>(&sdlNode));
-    if (fakeClient.m_channel.getMessage().m_messageType != DS::e_NetSuccess)
+    if (dm_auth_reply(fakeClient).m_messageType != DS::e_NetSuccess)
         fputs("[Game] Error writing SDL node back to vault\n", stderr);
 }
 
@@ -196,6 +533,7 @@ void dm_game_disconnect(GameHost_Private* host, Game_ClientMessage* msg)
         netMsg->unref();
 
         host->m_states.erase(msg->m_client->m_clientKey);
+        dm_invalidate_state(host);
     }
 
     MOUL::NetMsgMemberUpdate* memberMsg = MOUL::NetMsgMemberUpdate::Create();
@@ -251,17 +589,17 @@ void dm_game_disconnect(GameHost_Private* host, Game_ClientMessage* msg)
     // Good time to write this back to the vault
     dm_local_sdl_update(host, host->m_localState.toBlob());
 
-    // TODO: This should probably respect the age's LingerTime
-    //       As it is, there might be a race condition if another player is
-    //       joining just as the last player is leaving.
-    if (host->m_clients.size() == 0)
-        host->m_channel.putMessage(e_GameShutdown, nullptr);
-
     SEND_REPLY(msg, DS::e_NetSuccess);
 }
 
 void dm_game_join(GameHost_Private* host, Game_ClientMessage* msg)
 {
+    // Only this thread changes the state once the host is running
+    if (host->m_state != e_HostRunning) {
+        SEND_REPLY(msg, DS::e_NetRemoteShutdown);
+        return;
+    }
+
     // This does a few things for us...
     //   1. We get proper age node subscriptions (vault downloaded after we reply to this req)
     //   2. We ensure that the player is logged in and is supposed to be coming here.
@@ -273,7 +611,7 @@ void dm_game_join(GameHost_Private* host, Game_ClientMessage* msg)
     authReq.m_playerId = msg->m_client->m_clientInfo.m_PlayerId;
     s_authChannel.putMessage(e_AuthUpdateAgeSrv, reinterpret_cast<void*>(&authReq));
 
-    DS::FifoMessage authReply = fakeClient.m_channel.getMessage();
+    DS::FifoMessage authReply = dm_auth_reply(fakeClient);
     msg->m_client->m_isAdmin = authReq.m_isAdmin;
     if (authReply.m_messageType != DS::e_NetSuccess) {
         SEND_REPLY(msg, authReply.m_messageType);
@@ -316,10 +654,8 @@ void dm_game_join(GameHost_Private* host, Game_ClientMessage* msg)
     SEND_REPLY(msg, DS::e_NetSuccess);
 }
 
-void dm_send_state(GameHost_Private* host, GameClient_Private* client)
+void dm_build_state(GameHost_Private* host)
 {
-    check_postgres(host->m_postgres);
-
     MOUL::NetMsgSDLState* state = MOUL::NetMsgSDLState::Create();
     state->m_contentFlags = MOUL::NetMessage::e_HasTimeSent
                         | MOUL::NetMessage::e_NeedsReliableSend;
@@ -331,25 +667,32 @@ void dm_send_state(GameHost_Private* host, GameClient_Private* client)
     uint32_t states = 0;
     DS::Blob ageSdlBlob = host->m_ageSdlHook.toBlob();
     if (ageSdlBlob.size()) {
-        Game_AgeInfo info = s_ages[host->m_ageFilename];
+        Game_AgeInfo info = find_age_info(host->m_ageFilename);
         state->m_object.m_location = MOUL::Location(info.m_seqPrefix, -2, MOUL::Location::e_BuiltIn);
         state->m_object.m_name = "AgeSDLHook";
         state->m_object.m_type = 1;  // SceneObject
         state->m_object.m_id = 1;
         state->m_sdlBlob = std::move(ageSdlBlob);
-        DM_SENDMSG(state, client);
+        DM_WRITEBUF(state);
+        host->m_initialState.push_back(_msgbuf);
         ++states;
     }
 
     for (sdlstatemap_t::iterator state_iter = host->m_states.begin();
          state_iter != host->m_states.end(); ++state_iter) {
-        for (sdlnamemap_t::iterator it = state_iter->second.begin();
+        for (sdldescmap_t::iterator it = state_iter->second.begin();
              it != state_iter->second.end(); ++it) {
+            // Only states which changed since the last join need to be
+            // serialized again
+            if (!it->second.m_blob.size())
+                it->second.m_blob = it->second.m_state.toBlob();
+
             state->m_object = state_iter->first;
             state->m_isAvatar = it->second.m_isAvatar;
             state->m_persistOnServer = it->second.m_persist;
-            state->m_sdlBlob = it->second.m_state.toBlob();
-            DM_SENDMSG(state, client);
+            state->m_sdlBlob = it->second.m_blob.copy();
+            DM_WRITEBUF(state);
+            host->m_initialState.push_back(_msgbuf);
             ++states;
         }
     }
@@ -362,56 +705,82 @@ void dm_send_state(GameHost_Private* host, GameClient_Private* client)
                           | MOUL::NetMessage::e_NeedsReliableSend;
     reply->m_timestamp.setNow();
     reply->m_numStates = states;
-    DM_SENDMSG(reply, client);
+    DM_WRITEBUF(reply);
+    host->m_initialState.push_back(_msgbuf);
     reply->unref();
 }
 
+void dm_send_state(GameHost_Private* host, GameClient_Private* client)
+{
+    // The sequence always ends with NetMsgInitialAgeStateSent, so it is
+    // only empty if it needs to be rebuilt
+    if (host->m_initialState.empty())
+        dm_build_state(host);
+
+    for (DS::BufferStream* buf : host->m_initialState) {
+        buf->ref();
+        client->m_broadcast.putMessage(e_GameToCli_PropagateBuffer, buf);
+    }
+}
+
 void dm_save_sdl_state(GameHost_Private* host, const ST::string& descriptor,
                        const MOUL::Uoid& object, const SDL::State& state)
 {
-    check_postgres(host->m_postgres);
+    DS::PostgresPool::Lease postgres(s_gameDbPool);
+    if (!postgres) {
+        fputs("[Game] Could not save SDL state: No database connection\n", stderr);
+        return;
+    }
 
     DS::Blob sdlBlob = state.toBlob();
     DS::BufferStream buffer;
     object.write(&buffer);
     const ST::string object_b64 = ST::base64_encode(buffer.buffer(), buffer.size());
     const ST::string blob_b64 = ST::base64_encode(sdlBlob.buffer(), sdlBlob.size());
-    DS::PGresultRef result = DS::PQexecVA(host->m_postgres,
+    DS::PGresultRef result = DS::PQexecVA(postgres,
             "SELECT idx FROM game.\"AgeStates\""
             "    WHERE \"ServerIdx\"=$1 AND \"Descriptor\"=$2 AND \"ObjectKey\"=$3",
             host->m_serverIdx, descriptor, object_b64);
     if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-        PQ_PRINT_ERROR(host->m_postgres, SELECT);
+        PQ_PRINT_ERROR(postgres, SELECT);
         return;
     }
     if (PQntuples(result) == 0) {
-        result = DS::PQexecVA(host->m_postgres,
+        result = DS::PQexecVA(postgres,
                               "INSERT INTO game.\"AgeStates\""
                               "    (\"ServerIdx\", \"Descriptor\", \"ObjectKey\", \"SdlBlob\")"
                               "    VALUES ($1, $2, $3, $4)",
                               host->m_serverIdx, descriptor, object_b64, blob_b64);
         if (PQresultStatus(result) != PGRES_COMMAND_OK) {
-            PQ_PRINT_ERROR(host->m_postgres, INSERT);
+            PQ_PRINT_ERROR(postgres, INSERT);
             return;
         }
     } else {
         if (PQntuples(result) != 1)
             fputs("Warning: Multiple rows returned for age state\n", stderr);
         const ST::string stateIdx(PQgetvalue(result, 0, 0));
-        result = DS::PQexecVA(host->m_postgres,
+        result = DS::PQexecVA(postgres,
                               "UPDATE game.\"AgeStates\""
                               "    SET \"SdlBlob\"=$2 WHERE idx=$1",
                               stateIdx, blob_b64);
         if (PQresultStatus(result) != PGRES_COMMAND_OK) {
-            PQ_PRINT_ERROR(host->m_postgres, UPDATE);
+            PQ_PRINT_ERROR(postgres, UPDATE);
             return;
         }
     }
 }
 
+// Only the dirty variables of `state` are written to the wire.  Clients
+// already in the age have seen every previous update, so callers pass just
+// the parsed update, and only fall back to the merged state for initial sends.
+// A delta with nothing dirty would tell them nothing, so it isn't relayed;
+// initial states are always relayed, as they were before deltas.
 void dm_bcast_sdl_state(GameHost_Private* host, GameClient_Private* client,
                         const MOUL::NetMsgSDLState* update, const SDL::State& state)
 {
+    if (!update->m_isInitial && !state.isDirty())
+        return;
+
     MOUL::NetMsgSDLStateBCast* bcast = MOUL::NetMsgSDLStateBCast::Create();
     bcast->m_contentFlags = MOUL::NetMessage::e_HasPlayerID
                           | MOUL::NetMessage::e_HasTimeSent
@@ -459,32 +828,38 @@ void dm_read_sdl(GameHost_Private* host, GameClient_Private* client,
     if (state->m_object.m_name == "AgeSDLHook") {
         host->m_localState.add(update);
         host->m_ageSdlHook.add(update);
+        dm_invalidate_state(host);
         dm_local_sdl_update(host, host->m_localState.toBlob());
         if (bcast)
-            dm_bcast_sdl_state(host, client, state, host->m_ageSdlHook);
+            dm_bcast_sdl_state(host, client, state,
+                               state->m_isInitial ? host->m_ageSdlHook : update);
     } else {
         auto fobj = host->m_states.find(state->m_object);
-        if (fobj == host->m_states.end() || fobj->second.find(update.descriptor()->m_name) == fobj->second.end()) {
+        if (fobj == host->m_states.end() || fobj->second.find(update.descriptor()->m_id) == fobj->second.end()) {
             GameState gs;
             gs.m_isAvatar = state->m_isAvatar;
             gs.m_persist = state->m_persistOnServer;
             gs.m_state = update;
-            host->m_states[state->m_object][update.descriptor()->m_name] = gs;
+            host->m_states[state->m_object][update.descriptor()->m_id] = std::move(gs);
+            dm_invalidate_state(host);
 
             if (state->m_persistOnServer)
                 dm_save_sdl_state(host, update.descriptor()->m_name, state->m_object, update);
             if (bcast)
                 dm_bcast_sdl_state(host, client, state, update);
         } else {
-            GameState& gs = host->m_states[state->m_object][update.descriptor()->m_name];
+            GameState& gs = fobj->second[update.descriptor()->m_id];
             gs.m_isAvatar = state->m_isAvatar;
             gs.m_persist = state->m_persistOnServer;
             gs.m_state.add(update);
+            gs.m_blob = DS::Blob();
+            dm_invalidate_state(host);
 
             if (state->m_persistOnServer)
                 dm_save_sdl_state(host, update.descriptor()->m_name, state->m_object, gs.m_state);
             if (bcast)
-                dm_bcast_sdl_state(host, client, state, gs.m_state);
+                dm_bcast_sdl_state(host, client, state,
+                                   state->m_isInitial ? gs.m_state : update);
         }
     }
 }
@@ -620,43 +995,57 @@ void dm_load_clone(GameHost_Private* host, GameClient_Private* client,
     }
 }
 
-void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
+MOUL::NetMessage* DS::GameServer_ReadMessage(const DS::Blob& message,
+                                             uint32_t msgType)
 {
-    DS::BlobStream stream(msg->m_message);
+    DS::BlobStream stream(message);
     MOUL::NetMessage* netmsg = nullptr;
     try {
         netmsg = MOUL::Factory::Read<MOUL::NetMessage>(&stream);
     } catch (const MOUL::FactoryException&) {
-        ST::printf(stderr, "[Game] Warning: Ignoring message: {04X}\n",
-                   msg->m_messageType);
-        SEND_REPLY(msg, DS::e_NetInternalError);
-        return;
+        ST::printf(stderr, "[Game] Warning: Ignoring message: {04X}\n", msgType);
+        return nullptr;
     } catch (const std::exception& ex) {
-        // magickal code to print out the name of the offending plMessage
-        MOUL::NetMsgGameMessage* gameMsg = netmsg->Cast<MOUL::NetMsgGameMessage>();
-        if (gameMsg && gameMsg->m_message) {
-            switch (gameMsg->m_message->type()) {
-#define CREATABLE_TYPE(id, name) \
-            case id: \
-                ST::printf(stderr, "[Game] Exception reading " #name ": {}\n", ex.what()); \
-                break;
-#include "creatable_types.inl"
-#undef CREATABLE_TYPE
-            }
-        } else {
-            ST::printf(stderr, "[Game] Exception reading net message: {}\n",
-                       ex.what());
-        }
-        SEND_REPLY(msg, DS::e_NetInternalError);
-        return;
+        // Nothing was constructed, so there is no message to name here
+        ST::printf(stderr, "[Game] Exception reading net message {04X}: {}\n",
+                   msgType, ex.what());
+        return nullptr;
+    }
+    if (!netmsg) {
+        ST::printf(stderr, "[Game] Warning: Ignoring message: {04X}\n", msgType);
+        return nullptr;
     }
     if (!stream.atEof()) {
         ST::printf(stderr, "[Game] Incomplete parse of {04X}\n", netmsg->type());
         netmsg->unref();
+        return nullptr;
+    }
+    return netmsg;
+}
+
+void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
+{
+    // Only messages stamped on receipt are measured, so the stats can be
+    // toggled at any time without recording bogus latencies
+    bool measure = msg->m_received != std::chrono::steady_clock::time_point();
+    std::chrono::steady_clock::time_point parseStart;
+    if (measure)
+        parseStart = std::chrono::steady_clock::now();
+
+    MOUL::NetMessage* netmsg = DS::GameServer_ReadMessage(msg->m_message,
+                                                          msg->m_messageType);
+    if (!netmsg) {
         SEND_REPLY(msg, DS::e_NetInternalError);
         return;
     }
 
+    uint64_t parseNsec = 0;
+    if (measure) {
+        parseNsec = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - parseStart).count();
+    }
+
+    size_t fanout = 0;
     try {
         switch (msg->m_messageType) {
         case MOUL::ID_NetMsgPagingRoom:
@@ -670,11 +1059,11 @@ void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
                 gameMsg->m_message->m_bcastFlags |= MOUL::Message::e_NetNonLocal;
                 if (msg->m_client->m_isAdmin) {
                     if (gameMsg->m_contentFlags & MOUL::NetMessage::e_RouteToAllPlayers)
-                        dm_broadcast(host, netmsg, msg->m_client->m_clientInfo.m_PlayerId);
+                        fanout = dm_broadcast(host, netmsg, msg->m_client->m_clientInfo.m_PlayerId);
                     else
-                        dm_propagate(host, netmsg, msg->m_client->m_clientInfo.m_PlayerId);
+                        fanout = dm_propagate(host, netmsg, msg->m_client->m_clientInfo.m_PlayerId);
                 } else if (gameMsg->m_message->makeSafeForNet())
-                    dm_propagate(host, netmsg, msg->m_client->m_clientInfo.m_PlayerId);
+                    fanout = dm_propagate(host, netmsg, msg->m_client->m_clientInfo.m_PlayerId);
             }
             break;
         case MOUL::ID_NetMsgGameMessageDirected:
@@ -683,12 +1072,9 @@ void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
                         netmsg->Cast<MOUL::NetMsgGameMessageDirected>();
                 directedMsg->m_message->m_bcastFlags |= MOUL::Message::e_NetNonLocal;
                 if (msg->m_client->m_isAdmin || directedMsg->m_message->makeSafeForNet())
-                    dm_propagate_to(host, netmsg, directedMsg->m_receivers);
+                    fanout = dm_propagate_to(host, netmsg, directedMsg->m_receivers);
             }
             break;
-        case MOUL::ID_NetMsgVoice:
-            dm_propagate_to(host, netmsg, netmsg->Cast<MOUL::NetMsgVoice>()->m_receivers);
-            break;
         case MOUL::ID_NetMsgTestAndSet:
             dm_test_and_set(host, msg->m_client, netmsg->Cast<MOUL::NetMsgTestAndSet>());
             break;
@@ -718,13 +1104,28 @@ void dm_game_message(GameHost_Private* host, Game_PropagateMessage* msg)
     } catch (const DS::SockHup&) {
         // Client wasn't paying attention
     }
+
+    if (measure) {
+        // Game messages are only interesting by what they carry
+        uint16_t statsType = netmsg->type();
+        MOUL::NetMsgGameMessage* gameMsg = netmsg->Cast<MOUL::NetMsgGameMessage>();
+        if (gameMsg && gameMsg->m_message)
+            statsType = gameMsg->m_message->type();
+        uint64_t latencyUsec = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - msg->m_received).count();
+        DS::MsgStats_Record(statsType, msg->m_message.size(), parseNsec, fanout,
+                            latencyUsec);
+    }
+
     netmsg->unref();
     SEND_REPLY(msg, DS::e_NetSuccess);
 }
 
 void dm_bcast_agesdl_hook(GameHost_Private* host)
 {
-    Game_AgeInfo info = s_ages[host->m_ageFilename];
+    dm_invalidate_state(host);
+
+    Game_AgeInfo info = find_age_info(host->m_ageFilename);
 
     MOUL::NetMsgSDLStateBCast* bcast = MOUL::NetMsgSDLStateBCast::Create();
     bcast->m_contentFlags = MOUL::NetMessage::e_HasTimeSent
@@ -777,27 +1178,46 @@ void dm_local_sdl_update(GameHost_Private* host, Game_SdlMessage* msg)
     SEND_REPLY(msg, DS::e_NetSuccess);
 
     s_authChannel.putMessage(e_VaultUpdateNode, reinterpret_cast<void*>(&sdlNode));
-    if (fakeClient.m_channel.getMessage().m_messageType != DS::e_NetSuccess)
+    if (dm_auth_reply(fakeClient).m_messageType != DS::e_NetSuccess)
         fputs("[Game] Error writing SDL node back to vault\n", stderr);
 
     dm_bcast_agesdl_hook(host);
 }
 
-void dm_global_sdl_update(GameHost_Private* host)
+void dm_global_sdl_update(GameHost_Private* host, SDL::State* state)
 {
+    host->m_globalState = *state;
+    delete state;
     host->m_ageSdlHook.merge(host->m_globalState);
     dm_bcast_agesdl_hook(host);
 }
 
 void dm_gameHost(GameHost_Private* host)
 {
-    for ( ;; ) {
+    // Handle a bounded batch of messages, then requeue the host so busy
+    // ages can't monopolize a worker thread.
+    for (int batch = 0; batch < 32; ++batch) {
         DS::FifoMessage msg { -1, nullptr };
+        {
+            std::lock_guard<std::mutex> queueGuard(host->m_queueMutex);
+            if (host->m_queue.empty()) {
+                host->m_scheduled = false;
+                return;
+            }
+            msg = host->m_queue.front();
+            host->m_queue.pop();
+        }
+
         try {
-            msg = host->m_channel.getMessage();
             switch (msg.m_messageType) {
             case e_GameShutdown:
-                dm_game_shutdown(host);
+                dm_game_shutdown(host, false);
+                break;
+            case e_GameIdle:
+                dm_game_shutdown(host, true);
+                break;
+            case e_GameClose:
+                dm_game_close(host);
                 return;
             case e_GameDisconnect:
                 dm_game_disconnect(host, reinterpret_cast<Game_ClientMessage*>(msg.m_payload));
@@ -812,7 +1232,7 @@ void dm_gameHost(GameHost_Private* host)
                 dm_local_sdl_update(host, reinterpret_cast<Game_SdlMessage*>(msg.m_payload));
                 break;
             case e_GameGlobalSdlUpdate:
-                dm_global_sdl_update(host);
+                dm_global_sdl_update(host, reinterpret_cast<SDL::State*>(msg.m_payload));
                 break;
             default:
                 /* Invalid message...  This shouldn't happen */
@@ -824,7 +1244,7 @@ void dm_gameHost(GameHost_Private* host)
         } catch (const std::exception& ex) {
             ST::printf(stderr, "[Game] Exception raised processing message: {}\n",
                        ex.what());
-            if (msg.m_payload) {
+            if (msg.m_payload && msg.m_messageType != e_GameGlobalSdlUpdate) {
                 // Keep clients from blocking on a reply
                 SEND_REPLY(reinterpret_cast<Game_ClientMessage*>(msg.m_payload),
                            DS::e_NetInternalError);
@@ -832,37 +1252,209 @@ void dm_gameHost(GameHost_Private* host)
         }
     }
 
-    // This line should be unreachable
-    DS_ASSERT(false);
+    s_gameHostPool->submit([host] { dm_gameHost(host); });
 }
 
-GameHost_Private* start_game_host(uint32_t ageMcpId)
+/* Must be called with m_queueMutex held.  Returns true if the host needs
+ * to be handed to a worker. */
+static bool queue_game_host(GameHost_Private* host, int type, void* payload)
 {
-    PGconn* postgres = PQconnectdb(ST::format(
-                    "host='{}' port='{}' user='{}' password='{}' dbname='{}'",
-                    DS::Settings::DbHostname(), DS::Settings::DbPort(),
-                    DS::Settings::DbUsername(), DS::Settings::DbPassword(),
-                    DS::Settings::DbDbaseName()).c_str());
-    if (PQstatus(postgres) != CONNECTION_OK) {
-        ST::printf(stderr, "Error connecting to postgres: {}", PQerrorMessage(postgres));
-        PQfinish(postgres);
-        return nullptr;
+    if (host->m_state == e_HostClosing)
+        throw std::runtime_error("[Game] Host is shutting down");
+    host->m_queue.push(DS::FifoMessage { type, payload });
+
+    // Only one worker may process a host's messages at a time
+    if (host->m_scheduled)
+        return false;
+    host->m_scheduled = true;
+    return true;
+}
+
+void post_game_host(GameHost_Private* host, int type, void* payload)
+{
+    bool submit;
+    {
+        std::lock_guard<std::mutex> queueGuard(host->m_queueMutex);
+        submit = queue_game_host(host, type, payload);
     }
+    if (submit)
+        s_gameHostPool->submit([host] { dm_gameHost(host); });
+}
 
-    DS::PGresultRef result = DS::PQexecVA(postgres,
-            "SELECT \"AgeUuid\", \"AgeFilename\", \"AgeIdx\", \"SdlIdx\", \"Temporary\""
-            "    FROM game.\"Servers\" WHERE idx=$1",
-            ageMcpId);
-    if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-        PQ_PRINT_ERROR(postgres, SELECT);
-        result.reset();
-        PQfinish(postgres);
-        return nullptr;
+void detach_game_host(GameHost_Private* host)
+{
+    bool submit = false;
+    {
+        std::lock_guard<std::mutex> queueGuard(host->m_queueMutex);
+        if (--host->m_attached > 0)
+            return;
+
+        // TODO: This should probably respect the age's LingerTime
+        if (host->m_state == e_HostRunning)
+            submit = queue_game_host(host, e_GameIdle, nullptr);
+        else if (host->m_state == e_HostDraining)
+            submit = queue_game_host(host, e_GameClose, nullptr);
+    }
+    // The host can't close before this job runs, so it's still safe to use
+    if (submit)
+        s_gameHostPool->submit([host] { dm_gameHost(host); });
+}
+
+struct AgeStateRow
+{
+    ST::string m_descriptor, m_objectKey, m_sdlBlob;
+};
+
+struct AgeStateDecoded
+{
+    MOUL::Uoid m_key;
+    ST::string m_descriptor;
+    GameState m_state;
+    bool m_valid;
+};
+
+static void decode_age_states(const std::vector<AgeStateRow>& rows,
+                              std::vector<AgeStateDecoded>& decoded)
+{
+    decoded.resize(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        AgeStateDecoded& out = decoded[i];
+        out.m_descriptor = rows[i].m_descriptor;
+        out.m_valid = false;
+        try {
+            DS::Blob objblob = DS::Base64Decode(rows[i].m_objectKey);
+            DS::BlobStream bsObject(objblob);
+            out.m_key.read(&bsObject);
+
+            DS::Blob sdlblob = DS::Base64Decode(rows[i].m_sdlBlob);
+            out.m_state.m_isAvatar = false;
+            out.m_state.m_persist = true;
+            out.m_state.m_state = SDL::State::FromBlob(sdlblob);
+            if (!out.m_state.m_state.descriptor())
+                throw DS::MalformedData();
+            if (!out.m_state.m_state.update())
+                out.m_state.m_blob = std::move(sdlblob);
+            out.m_valid = true;
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[SDL] Error parsing state {} for [{04X}]{}: {}\n",
+                       rows[i].m_descriptor, out.m_key.m_type, out.m_key.m_name,
+                       ex.what());
+        }
+    }
+}
+
+/* Rows are streamed from the database one at a time and decoded in
+ * batches on the host pool while the rest are still arriving.  Must not be
+ * called from a pool thread, since it waits for the batches to finish.
+ * Returns false if the states couldn't all be read, in which case the host
+ * must not start, or it would save over the states it didn't load. */
+bool dm_load_states(GameHost_Private* host)
+{
+    static const size_t BATCH_SIZE = 64;
+
+    struct Batch
+    {
+        std::vector<AgeStateRow> m_rows;
+        std::vector<AgeStateDecoded> m_decoded;
+    };
+    std::list<Batch> batches;
+    std::mutex pendingMutex;
+    std::condition_variable pendingDone;
+    size_t pending = 0;
+
+    auto submit_batch = [&](Batch& batch) {
+        {
+            std::lock_guard<std::mutex> pendingGuard(pendingMutex);
+            ++pending;
+        }
+        s_gameHostPool->submit([&batch, &pendingMutex, &pendingDone, &pending] {
+            decode_age_states(batch.m_rows, batch.m_decoded);
+            std::lock_guard<std::mutex> pendingGuard(pendingMutex);
+            if (--pending == 0)
+                pendingDone.notify_one();
+        });
+    };
+
+    bool failed = false;
+    {
+        DS::PostgresPool::Lease postgres(s_gameDbPool);
+        if (!postgres)
+            return false;
+
+        if (!DS::PQsendVA(postgres,
+                "SELECT \"Descriptor\", \"ObjectKey\", \"SdlBlob\""
+                "    FROM game.\"AgeStates\" WHERE \"ServerIdx\"=$1",
+                host->m_serverIdx)) {
+            PQ_PRINT_ERROR(postgres, SELECT);
+            return false;
+        }
+        if (!PQsetSingleRowMode(postgres))
+            fputs("[Game] WARNING: Could not stream AgeStates rows\n", stderr);
+
+        batches.emplace_back();
+        for ( ;; ) {
+            DS::PGresultRef result = PQgetResult(postgres);
+            if (!result)
+                break;
+            ExecStatusType status = PQresultStatus(result);
+            if (status != PGRES_SINGLE_TUPLE && status != PGRES_TUPLES_OK) {
+                // Keep reading until the connection is ready for reuse
+                PQ_PRINT_ERROR(postgres, SELECT);
+                failed = true;
+                continue;
+            }
+
+            int count = PQntuples(result);
+            for (int i = 0; i < count; ++i) {
+                if (batches.back().m_rows.size() == BATCH_SIZE) {
+                    submit_batch(batches.back());
+                    batches.emplace_back();
+                }
+                batches.back().m_rows.push_back(AgeStateRow {
+                    PQgetvalue(result, i, 0), PQgetvalue(result, i, 1),
+                    PQgetvalue(result, i, 2)
+                });
+            }
+        }
+    }
+
+    // The last (partial) batch is decoded here while the others finish
+    decode_age_states(batches.back().m_rows, batches.back().m_decoded);
+    {
+        std::unique_lock<std::mutex> pendingLock(pendingMutex);
+        pendingDone.wait(pendingLock, [&pending] { return pending == 0; });
+    }
+    if (failed)
+        return false;
+
+    for (Batch& batch : batches) {
+        for (AgeStateDecoded& state : batch.m_decoded) {
+            if (state.m_valid)
+                host->m_states[state.m_key][state.m_state.m_state.descriptor()->m_id] = std::move(state.m_state);
+        }
+    }
+    return true;
+}
+
+GameHost_Private* start_game_host(uint32_t ageMcpId)
+{
+    DS::PGresultRef result;
+    {
+        DS::PostgresPool::Lease postgres(s_gameDbPool);
+        if (!postgres)
+            return nullptr;
+
+        result = DS::PQexecVA(postgres,
+                "SELECT \"AgeUuid\", \"AgeFilename\", \"AgeIdx\", \"SdlIdx\", \"Temporary\""
+                "    FROM game.\"Servers\" WHERE idx=$1",
+                ageMcpId);
+        if (PQresultStatus(result) != PGRES_TUPLES_OK) {
+            PQ_PRINT_ERROR(postgres, SELECT);
+            return nullptr;
+        }
     }
     if (PQntuples(result) == 0) {
         ST::printf(stderr, "[Game] Age MCP {} not found\n", ageMcpId);
-        result.reset();
-        PQfinish(postgres);
         return nullptr;
     } else {
         if (PQntuples(result) != 1) {
@@ -875,8 +1467,11 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         host->m_ageFilename = PQgetvalue(result, 0, 1);
         host->m_ageIdx = strtoul(PQgetvalue(result, 0, 2), nullptr, 10);
         host->m_gameMaster = 0;
+        host->m_scheduled = false;
+        host->m_state = e_HostRunning;
+        host->m_attached = 1;   // The client that is starting it
+        host->m_reservedSlots = 0;
         host->m_serverIdx = ageMcpId;
-        host->m_postgres = postgres;
         host->m_temp = strcmp("t", PQgetvalue(result, 0, 4)) == 0;
 
         // Fetch the age states
@@ -888,10 +1483,21 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         result.reset();
 
         s_authChannel.putMessage(e_AuthFetchSDL, reinterpret_cast<void*>(&sdlFetch));
+
+        // Nothing else can see the host yet, so the object states can be
+        // loaded while the auth daemon is busy with the vault
+        bool loaded = dm_restore(host) || dm_load_states(host);
+
+        // Always wait for the reply, since the auth daemon writes to sdlFetch
         DS::FifoMessage reply = fakeClient.m_channel.getMessage();
+        if (!loaded) {
+            ST::printf(stderr, "[Game] Could not load the states for {} (MCP {})\n",
+                       host->m_ageFilename, ageMcpId);
+            delete host;
+            return nullptr;
+        }
         if (reply.m_messageType != DS::e_NetSuccess) {
             fputs("[Game] Error fetching Age SDL\n", stderr);
-            PQfinish(postgres);
             delete host;
             return nullptr;
         }
@@ -904,13 +1510,13 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         } catch (const std::exception& ex) {
             ST::printf(stderr, "[SDL] Error parsing Age SDL state for {}: {}\n",
                        host->m_ageFilename, ex.what());
-            PQfinish(postgres);
             delete host;
             return nullptr;
         }
         if (!host->m_localState.descriptor()) {
             // NULL VaultSDL Node (or it doesn't exist) -- maybe there is a descriptor now?
-            SDL::StateDescriptor* desc = SDL::DescriptorDb::FindLatestDescriptor(host->m_ageFilename);
+            SDL::DescriptorDb::Lease descriptors;
+            SDL::StateDescriptor* desc = descriptors.findLatest(host->m_ageFilename);
             if (desc) {
                 host->m_localState = SDL::State(desc);
                 DS::Blob local = host->m_localState.toBlob();
@@ -928,45 +1534,12 @@ GameHost_Private* start_game_host(uint32_t ageMcpId)
         }
         host->m_ageSdlHook.merge(host->m_globalState);
 
+        // Only publish the host once its state is complete, so the first
+        // join can be answered as soon as it's dequeued
         s_gameHostMutex.lock();
         s_gameHosts[ageMcpId] = host;
         s_gameHostMutex.unlock();
 
-        // Fetch initial server state
-        result = DS::PQexecVA(host->m_postgres,
-                "SELECT \"Descriptor\", \"ObjectKey\", \"SdlBlob\""
-                "    FROM game.\"AgeStates\" WHERE \"ServerIdx\"=$1",
-                host->m_serverIdx);
-        if (PQresultStatus(result) != PGRES_TUPLES_OK) {
-            PQ_PRINT_ERROR(host->m_postgres, SELECT);
-        } else {
-            int count = PQntuples(result);
-
-            for (int i=0; i<count; ++i) {
-                DS::Blob objblob = DS::Base64Decode(PQgetvalue(result, i, 1));
-                DS::BlobStream bsObject(objblob);
-                DS::Blob sdlblob = DS::Base64Decode(PQgetvalue(result, i, 2));
-                MOUL::Uoid key;
-                key.read(&bsObject);
-                try {
-                    SDL::State state = SDL::State::FromBlob(sdlblob);
-                    state.update();
-
-                    GameState gs;
-                    gs.m_isAvatar = false;
-                    gs.m_persist = true;
-                    gs.m_state = state;
-                    host->m_states[key][PQgetvalue(result, i, 0)] = gs;
-                } catch (const std::exception& ex) {
-                    ST::printf(stderr, "[SDL] Error parsing state {} for [{04X}]{}: {}\n",
-                               PQgetvalue(result, i, 0), key.m_type, key.m_name,
-                               ex.what());
-                }
-            }
-        }
-
-        std::thread threadh(&dm_gameHost, host);
-        threadh.detach();
         return host;
     }
 }
@@ -16,11 +16,13 @@
  ******************************************************************************/
 
 #include "GameServer_Private.h"
+#include "MsgStats.h"
 #include "settings.h"
 #include "errors.h"
 #include <string_theory/format>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <poll.h>
 #include <chrono>
 #include <functional>
@@ -79,13 +81,30 @@ void game_client_init(GameClient_Private& client)
     DS::SendBuffer(client.m_sock, client.m_buffer.buffer(), client.m_buffer.size());
 }
 
+/* The returned host is attached to the caller, which must detach from it
+ * with detach_game_host() when it's done. */
 GameHost_Private* find_game_host(uint32_t ageMcpId)
 {
     {
-        std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
-        hostmap_t::iterator host_iter = s_gameHosts.find(ageMcpId);
-        if (host_iter != s_gameHosts.end())
-            return host_iter->second;
+        std::unique_lock<std::mutex> gameHostLock(s_gameHostMutex);
+        for ( ;; ) {
+            hostmap_t::iterator host_iter = s_gameHosts.find(ageMcpId);
+            if (host_iter == s_gameHosts.end())
+                break;
+
+            GameHost_Private* host = host_iter->second;
+            {
+                std::lock_guard<std::mutex> queueGuard(host->m_queueMutex);
+                if (host->m_state == e_HostRunning) {
+                    ++host->m_attached;
+                    return host;
+                }
+            }
+
+            // The old host is on its way out and still has state to save,
+            // so wait for it rather than start a second copy of the age
+            s_gameHostClosed.wait(gameHostLock);
+        }
     }
     try {
         return start_game_host(ageMcpId);
@@ -135,6 +154,44 @@ void cb_join(GameClient_Private& client)
         return;
     }
 
+    // The auth server steers players away from full public instances, but
+    // this is where the limit is actually enforced.  The slot is reserved
+    // until the player is added below, so that a burst of joins can't all
+    // pass the check before any of them has been added.
+    struct SlotReservation
+    {
+        GameHost_Private* m_host = nullptr;
+
+        ~SlotReservation()
+        {
+            if (m_host) {
+                std::lock_guard<std::mutex> clientGuard(m_host->m_clientMutex);
+                --m_host->m_reservedSlots;
+            }
+        }
+    } reservation;
+
+    uint32_t capacity = DS::GameServer_GetCapacity(client.m_host->m_ageFilename);
+    if (capacity) {
+        std::lock_guard<std::mutex> clientGuard(client.m_host->m_clientMutex);
+        if (client.m_host->m_clients.count(client.m_clientInfo.m_PlayerId) == 0) {
+            uint32_t population = client.m_host->m_clients.size()
+                                + client.m_host->m_reservedSlots;
+            if (population >= capacity) {
+                ST::printf(stderr, "[Game] {} is full ({} players), turning away {}\n",
+                           client.m_host->m_ageFilename, population,
+                           client.m_clientInfo.m_PlayerId);
+                detach_game_host(client.m_host);
+                client.m_host = nullptr;
+                client.m_buffer.write<uint32_t>(DS::e_NetServerBusy);
+                SEND_REPLY();
+                return;
+            }
+            ++client.m_host->m_reservedSlots;
+            reservation.m_host = client.m_host;
+        }
+    }
+
     // Get player info from the vault
     Auth_NodeInfo nodeInfo;
     nodeInfo.m_client = &client;
@@ -145,19 +202,27 @@ void cb_join(GameClient_Private& client)
     if (reply.m_messageType != DS::e_NetSuccess) {
         client.m_buffer.write<uint32_t>(reply.m_messageType);
         SEND_REPLY();
-        return;
+        // Hang up so we detach from the host
+        throw DS::SockHup();
     }
     msg.m_client->m_clientInfo.set_PlayerName(nodeInfo.m_node.m_IString64_1);
     msg.m_client->m_clientInfo.set_CCRLevel(0);
-    client.m_host->m_channel.putMessage(e_GameJoinAge, reinterpret_cast<void*>(&msg));
+    post_game_host(client.m_host, e_GameJoinAge, reinterpret_cast<void*>(&msg));
 
     reply = client.m_channel.getMessage();
     client.m_buffer.write<uint32_t>(reply.m_messageType);
 
     SEND_REPLY();
+    if (reply.m_messageType != DS::e_NetSuccess)
+        throw DS::SockHup();
 
+    // The player now fills the slot they reserved
     client.m_host->m_clientMutex.lock();
     client.m_host->m_clients[client.m_clientInfo.m_PlayerId] = &client;
+    if (reservation.m_host) {
+        --client.m_host->m_reservedSlots;
+        reservation.m_host = nullptr;
+    }
     client.m_host->m_clientMutex.unlock();
 }
 
@@ -166,13 +231,21 @@ void cb_netmsg(GameClient_Private& client)
     Game_PropagateMessage msg;
     msg.m_client = &client;
     msg.m_messageType = DS::CryptRecvValue<uint32_t>(client.m_sock, client.m_crypt);
+    if (DS::MsgStats_Enabled())
+        msg.m_received = std::chrono::steady_clock::now();
 
+    // Received into shared storage, so the parsed message's payloads
+    // can view this buffer instead of copying out of it
     uint32_t size = DS::CryptRecvSize(client.m_sock, client.m_crypt);
-    std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
-    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, buffer.get(), size);
-    msg.m_message = DS::Blob::Steal(buffer.release(), size);
-    if (client.m_host) {
-        client.m_host->m_channel.putMessage(e_GamePropagate, reinterpret_cast<void*>(&msg));
+    DS::SharedBuffer* buffer = DS::SharedBuffer::Create(size);
+    msg.m_message = DS::Blob::Share(buffer);
+    buffer->unref();
+    DS::CryptRecvBuffer(client.m_sock, client.m_crypt, buffer->data(), size);
+    if (client.m_host && msg.m_messageType == MOUL::ID_NetMsgVoice) {
+        // Voice doesn't touch any host state, so skip the host's queue
+        relay_voice(client.m_host, &msg);
+    } else if (client.m_host) {
+        post_game_host(client.m_host, e_GamePropagate, reinterpret_cast<void*>(&msg));
         client.m_channel.getMessage();
     } else {
         ST::printf(stderr, "Client {} sent a game message with no game host connection\n",
@@ -291,11 +364,12 @@ void wk_gameWorker(DS::SocketHandle sockp)
         Game_ClientMessage msg;
         msg.m_client = &client;
         try {
-            client.m_host->m_channel.putMessage(e_GameDisconnect, reinterpret_cast<void*>(&msg));
+            post_game_host(client.m_host, e_GameDisconnect, reinterpret_cast<void*>(&msg));
             client.m_channel.getMessage();
         } catch (const std::exception& ex) {
             ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
         }
+        detach_game_host(client.m_host);
     }
 
     // Drain the broadcast channel
@@ -317,6 +391,12 @@ static int sel_age(const dirent* de)
     return strcmp(strrchr(de->d_name, '.'), ".age") == 0;
 }
 
+static int sel_hibernate(const dirent* de)
+{
+    const char* ext = strrchr(de->d_name, '.');
+    return ext && strcmp(ext, ".hib") == 0;
+}
+
 Game_AgeInfo age_parse(FILE* stream)
 {
     char lnbuffer[4096];
@@ -352,6 +432,33 @@ Game_AgeInfo age_parse(FILE* stream)
 
 void DS::GameServer_Init()
 {
+    size_t threads = DS::Settings::GameThreads();
+    if (threads == 0)
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    s_gameHostPool = new DS::ThreadPool(threads);
+    DS::MsgStats_SetEnabled(DS::Settings::GameMessageStats());
+    MOUL::NetMsgStream::SetCompressThreshold(DS::Settings::GameCompressThreshold());
+    s_gameDbPool = new DS::PostgresPool(DS::Settings::GameDbConnections());
+    s_gameDbPool->warmup(DS::Settings::GameDbWarmConnections());
+
+    // Hibernated hosts may be out of date if the database was modified
+    // while the server was down, so they don't survive a restart.
+    ST::string hibernatePath = DS::Settings::GameHibernatePath();
+    if (!hibernatePath.empty()) {
+        dirent** dirls;
+        int count = scandir(hibernatePath.c_str(), &dirls, &sel_hibernate, &alphasort);
+        if (count < 0) {
+            ST::printf(stderr, "[Game] Error reading hibernation path: {}\n", strerror(errno));
+        } else {
+            for (int i=0; i<count; ++i) {
+                ST::string filename = ST::format("{}/{}", hibernatePath, dirls[i]->d_name);
+                unlink(filename.c_str());
+                free(dirls[i]);
+            }
+            free(dirls);
+        }
+    }
+
     dirent** dirls;
     int count = scandir(DS::Settings::AgePath(), &dirls, &sel_age, &alphasort);
     if (count < 0) {
@@ -401,40 +508,44 @@ void DS::GameServer_Add(DS::SocketHandle client)
 
 void DS::GameServer_Shutdown()
 {
+    // Each host drains, saves and closes on its own pool worker, so they
+    // all shut down in parallel; we just wait for the last one to go.
+    bool complete;
     {
-        std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+        std::unique_lock<std::mutex> gameHostLock(s_gameHostMutex);
         hostmap_t::iterator host_iter;
         for (host_iter = s_gameHosts.begin(); host_iter != s_gameHosts.end(); ++host_iter) {
             try {
-                host_iter->second->m_channel.putMessage(e_GameShutdown);
+                post_game_host(host_iter->second, e_GameShutdown);
             } catch (const std::exception& ex) {
                 ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
             }
         }
+        complete = s_gameHostClosed.wait_for(gameHostLock, std::chrono::seconds(5),
+                                             [] { return s_gameHosts.empty(); });
     }
-
-    bool complete = false;
-    for (int i=0; i<50 && !complete; ++i) {
-        s_gameHostMutex.lock();
-        size_t alive = s_gameHosts.size();
-        s_gameHostMutex.unlock();
-        if (alive == 0)
-            complete = true;
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-    if (!complete)
+    if (complete) {
+        delete s_gameHostPool;
+        s_gameHostPool = nullptr;
+        delete s_gameDbPool;
+        s_gameDbPool = nullptr;
+    } else {
+        // Leave the pool running rather than wait forever on a stuck host
         fputs("[Game] Servers didn't die after 5 seconds!\n", stderr);
+    }
 }
 
-void DS::GameServer_UpdateGlobalSDL(const ST::string& age)
+void DS::GameServer_UpdateGlobalSDL(const ST::string& age, const SDL::State& state)
 {
     std::lock_guard<std::mutex> lock(s_gameHostMutex);
     for (auto it = s_gameHosts.begin(); it != s_gameHosts.end(); ++it) {
         if (!it->second || it->second->m_ageFilename != age)
             continue;
+        SDL::State* update = new SDL::State(state);
         try {
-            it->second->m_channel.putMessage(e_GameGlobalSdlUpdate, nullptr);
+            post_game_host(it->second, e_GameGlobalSdlUpdate, update);
         } catch (const std::exception& ex) {
+            delete update;
             ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
         }
     }
@@ -455,7 +566,7 @@ uint32_t DS::GameServer_UpdateVaultSDL(const DS::Vault::Node& node, uint32_t age
         msg.m_client = &client;
         msg.m_node = node.copy();
         try {
-            host->m_channel.putMessage(e_GameLocalSdlUpdate, &msg);
+            post_game_host(host, e_GameLocalSdlUpdate, &msg);
             return client.m_channel.getMessage().m_messageType;
         } catch (const std::exception& ex) {
             ST::printf(stderr, "[Game] WARNING: {}\n", ex.what());
@@ -470,9 +581,12 @@ void DS::GameServer_DisplayClients()
     if (s_gameHosts.size())
         fputs("Game Servers:\n", stdout);
     for (hostmap_t::iterator host_iter = s_gameHosts.begin(); host_iter != s_gameHosts.end(); ++host_iter) {
-        ST::printf("    {} {}\n", host_iter->second->m_ageFilename,
-                   host_iter->second->m_instanceId.toString(true));
         std::lock_guard<std::mutex> clientGuard(host_iter->second->m_clientMutex);
+        uint32_t capacity = GameServer_GetCapacity(host_iter->second->m_ageFilename);
+        ST::printf("    {} {} ({}/{})\n", host_iter->second->m_ageFilename,
+                   host_iter->second->m_instanceId.toString(true),
+                   host_iter->second->m_clients.size(),
+                   capacity ? ST::format("{}", capacity) : ST_LITERAL("-"));
         for (auto client_iter = host_iter->second->m_clients.begin();
              client_iter != host_iter->second->m_clients.end(); ++ client_iter)
             ST::printf("      * {} - {} ({})\n", DS::SockIpAddress(client_iter->second->m_sock),
@@ -481,12 +595,64 @@ void DS::GameServer_DisplayClients()
     }
 }
 
+void DS::GameServer_DisplayDbPool()
+{
+    DS::PostgresPool::Stats stats = s_gameDbPool->stats();
+    ST::printf("Game DB pool: {} open, {} idle, {} max\n", stats.m_open,
+               stats.m_idle, DS::Settings::GameDbConnections());
+    ST::printf("    {} acquired, {} waited, {.3f} ms avg wait, {.3f} ms max wait\n",
+               stats.m_acquires, stats.m_waits,
+               stats.m_acquires ? stats.m_totalWaitUsec / 1000.0 / stats.m_acquires : 0.0,
+               stats.m_maxWaitUsec / 1000.0);
+}
+
 uint32_t DS::GameServer_GetNumClients(Uuid instance)
 {
     std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
     for (auto it = s_gameHosts.begin(); it != s_gameHosts.end(); ++it) {
-        if (it->second->m_instanceId == instance)
+        if (it->second->m_instanceId == instance) {
+            std::lock_guard<std::mutex> clientGuard(it->second->m_clientMutex);
             return it->second->m_clients.size();
+        }
     }
     return 0;
 }
+
+bool DS::GameServer_HasClient(Uuid instance, uint32_t playerId)
+{
+    std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+    for (auto it = s_gameHosts.begin(); it != s_gameHosts.end(); ++it) {
+        if (it->second->m_instanceId == instance) {
+            std::lock_guard<std::mutex> clientGuard(it->second->m_clientMutex);
+            return it->second->m_clients.count(playerId) != 0;
+        }
+    }
+    return false;
+}
+
+uint32_t DS::GameServer_GetCapacity(const ST::string& ageFilename)
+{
+    if (!DS::Settings::GameEnforceCapacity())
+        return 0;
+    auto age_iter = s_ages.find(ageFilename);
+    return (age_iter != s_ages.end()) ? age_iter->second.m_maxCapacity : 0;
+}
+
+ST::string DS::GameServer_PopulationJson()
+{
+    ST::string_stream json;
+    json << "{\"instances\":[";
+    std::lock_guard<std::mutex> gameHostGuard(s_gameHostMutex);
+    for (auto it = s_gameHosts.begin(); it != s_gameHosts.end(); ++it) {
+        std::lock_guard<std::mutex> clientGuard(it->second->m_clientMutex);
+        if (it != s_gameHosts.begin())
+            json << ",";
+        json << ST::format("{{\"age\":\"{}\",\"instance\":\"{}\",\"mcpId\":{},"
+                           "\"population\":{},\"capacity\":{}}}",
+                           it->second->m_ageFilename, it->second->m_instanceId.toString(true),
+                           it->first, it->second->m_clients.size(),
+                           GameServer_GetCapacity(it->second->m_ageFilename));
+    }
+    json << "]}";
+    return json.to_string();
+}
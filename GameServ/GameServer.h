@@ -22,6 +22,16 @@
 #include "Types/Uuid.h"
 #include <exception>
 
+namespace SDL
+{
+    class State;
+}
+
+namespace MOUL
+{
+    class NetMessage;
+}
+
 namespace DS
 {
     namespace Vault {
@@ -32,11 +42,25 @@ namespace DS
     void GameServer_Add(SocketHandle client);
     void GameServer_Shutdown();
 
-    void GameServer_UpdateGlobalSDL(const ST::string& age);
+    void GameServer_UpdateGlobalSDL(const ST::string& age, const SDL::State& state);
+
+    /* Rewrites stored age object states and vault SDL nodes which were
+     * saved with an older descriptor version.  Returns false on errors. */
+    bool GameServer_UpgradeSDL();
     uint32_t GameServer_UpdateVaultSDL(const DS::Vault::Node& node, uint32_t ageMcpId);
 
+    /* Parses a propagated game message.  Malformed messages are logged and
+     * yield nullptr instead of throwing. */
+    MOUL::NetMessage* GameServer_ReadMessage(const DS::Blob& message, uint32_t msgType);
+
     void GameServer_DisplayClients();
+    void GameServer_DisplayDbPool();
     uint32_t GameServer_GetNumClients(Uuid instance);
+    bool GameServer_HasClient(Uuid instance, uint32_t playerId);
+
+    /* Player limit for instances of an age, or 0 if there is none */
+    uint32_t GameServer_GetCapacity(const ST::string& ageFilename);
+    ST::string GameServer_PopulationJson();
 }
 
 #endif
@@ -19,17 +19,21 @@
 #include "AuthServ/AuthClient.h"
 #include "NetIO/CryptIO.h"
 #include "NetIO/MsgChannel.h"
+#include "NetIO/ThreadPool.h"
 #include "Types/Uuid.h"
 #include "PlasMOUL/factory.h"
 #include "PlasMOUL/NetMessages/NetMsgMembersList.h"
 #include "PlasMOUL/NetMessages/NetMsgLoadClone.h"
 #include "SDL/StateInfo.h"
-#include "db/pqaccess.h"
+#include "db/pqpool.h"
 #include <unordered_map>
 #include <unordered_set>
 #include <list>
+#include <queue>
 #include <thread>
+#include <chrono>
 #include <mutex>
+#include <condition_variable>
 
 enum GameServer_MsgIds
 {
@@ -45,10 +49,17 @@ struct GameState
     bool m_persist;
     bool m_isAvatar;
     SDL::State m_state;
+
+    // Serialized m_state, built on demand for joining clients.
+    // Empty whenever m_state has changed since it was last built.  m_state
+    // may share data with other states, but shared data is copied before
+    // it changes, so only this host's own updates can make the blob stale.
+    DS::Blob m_blob;
 };
 
-typedef std::unordered_map<ST::string, GameState, ST::hash> sdlnamemap_t;
-typedef std::unordered_map<MOUL::Uoid, sdlnamemap_t, MOUL::UoidHash> sdlstatemap_t;
+// Keyed by StateDescriptor::m_id, which is the same for every version
+typedef std::unordered_map<uint32_t, GameState> sdldescmap_t;
+typedef std::unordered_map<MOUL::Uoid, sdldescmap_t, MOUL::UoidHash> sdlstatemap_t;
 typedef std::unordered_map<MOUL::Uoid, uint32_t, MOUL::UoidHash> lockmap_t;
 
 struct GameClient_Private : public AuthClient_Private
@@ -63,6 +74,13 @@ struct GameClient_Private : public AuthClient_Private
     bool m_isAdmin;
 };
 
+enum GameHostState
+{
+    e_HostRunning,      // Accepting players
+    e_HostDraining,     // Waiting for its client threads to let go
+    e_HostClosing,      // Saving state; no more messages are accepted
+};
+
 struct GameHost_Private
 {
     DS::Uuid m_instanceId;
@@ -74,13 +92,30 @@ struct GameHost_Private
     lockmap_t m_locks;
     uint32_t m_gameMaster;
     std::mutex m_clientMutex;
+
+    // Also guarded by m_clientMutex.  Players who passed the capacity check
+    // and are still joining, so they aren't in m_clients yet.
+    uint32_t m_reservedSlots;
+
     std::mutex m_lockMutex;
     std::mutex m_gmMutex;
-    DS::MsgChannel m_channel;
 
-    PGconn* m_postgres;
+    // Messages for this host, handled in order by one pool worker at a time
+    std::mutex m_queueMutex;
+    std::queue<DS::FifoMessage> m_queue;
+    bool m_scheduled;
+
+    // Also guarded by m_queueMutex.  Each client thread holding a pointer
+    // to this host is attached; the host can't close until they detach.
+    GameHostState m_state;
+    int m_attached;
+
     sdlstatemap_t m_states;
 
+    // Pre-built initial state message sequence shared by all joining
+    // clients.  Empty when any state has changed since it was last sent.
+    std::vector<DS::BufferStream*> m_initialState;
+
     uint32_t m_sdlIdx;
     SDL::State m_globalState;
     SDL::State m_localState;
@@ -92,6 +127,9 @@ struct GameHost_Private
 typedef std::unordered_map<uint32_t, GameHost_Private*> hostmap_t;
 extern hostmap_t s_gameHosts;
 extern std::mutex s_gameHostMutex;
+extern std::condition_variable s_gameHostClosed;
+extern DS::ThreadPool* s_gameHostPool;
+extern DS::PostgresPool* s_gameDbPool;
 
 struct Game_AgeInfo
 {
@@ -105,12 +143,16 @@ struct Game_AgeInfo
           m_seqPrefix(0) { }
 };
 typedef std::unordered_map<ST::string, Game_AgeInfo, ST::hash> agemap_t;
+
+// Filled in by GameServer_Init and only read after that, so any thread may
+// look ages up without locking.  Use find_age_info() rather than operator[].
 extern agemap_t s_ages;
+Game_AgeInfo find_age_info(const ST::string& ageFilename);
 
 enum GameHostMessages
 {
     e_GameShutdown, e_GameDisconnect, e_GameJoinAge, e_GamePropagate,
-    e_GameLocalSdlUpdate, e_GameGlobalSdlUpdate
+    e_GameLocalSdlUpdate, e_GameGlobalSdlUpdate, e_GameIdle, e_GameClose
 };
 
 struct Game_ClientMessage
@@ -122,6 +164,9 @@ struct Game_PropagateMessage : public Game_ClientMessage
 {
     uint32_t m_messageType;
     DS::Blob m_message;
+
+    // Set only while message stats are being collected
+    std::chrono::steady_clock::time_point m_received;
 };
 
 struct Game_SdlMessage : public Game_ClientMessage
@@ -130,3 +175,6 @@ struct Game_SdlMessage : public Game_ClientMessage
 };
 
 GameHost_Private* start_game_host(uint32_t ageMcpId);
+void post_game_host(GameHost_Private* host, int type, void* payload = nullptr);
+void detach_game_host(GameHost_Private* host);
+void relay_voice(GameHost_Private* host, Game_PropagateMessage* msg);
@@ -0,0 +1,195 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "MsgStats.h"
+#include "PlasMOUL/creatable.h"
+
+#include <string_theory/format>
+#include <string_theory/stdio>
+
+std::atomic<bool> DS::s_msgStatsEnabled;
+
+enum
+{
+#define CREATABLE_TYPE(id, name) \
+    e_Stats_##name,
+#include "creatable_types.inl"
+#undef CREATABLE_TYPE
+    e_Stats_Unknown, e_NumStatsTypes
+};
+
+static const char* s_statsNames[] = {
+#define CREATABLE_TYPE(id, name) \
+    #name,
+#include "creatable_types.inl"
+#undef CREATABLE_TYPE
+    "(unknown)",
+};
+
+static int stats_index(uint16_t type)
+{
+    switch (type) {
+#define CREATABLE_TYPE(id, name) \
+    case id: return e_Stats_##name;
+#include "creatable_types.inl"
+#undef CREATABLE_TYPE
+    default: return e_Stats_Unknown;
+    }
+}
+
+/* Log-linear latency buckets (in the style of HDR histograms): each power
+ * of two is split into four linear sub-buckets, so any recorded value is
+ * within 25% of its bucket's lower bound.  Covers up to ~30 minutes. */
+enum { e_SubBucketBits = 2, e_NumLatencyBuckets = 120 };
+
+static int latency_bucket(uint64_t usec)
+{
+    if (usec < (1 << e_SubBucketBits))
+        return static_cast<int>(usec);
+    int msb = 63 - __builtin_clzll(usec);
+    int sub = (usec >> (msb - e_SubBucketBits)) & ((1 << e_SubBucketBits) - 1);
+    int bucket = ((msb - e_SubBucketBits + 1) << e_SubBucketBits) + sub;
+    return bucket < e_NumLatencyBuckets ? bucket : e_NumLatencyBuckets - 1;
+}
+
+static uint64_t latency_bucket_floor(int bucket)
+{
+    if (bucket < (1 << e_SubBucketBits))
+        return bucket;
+    int msb = (bucket >> e_SubBucketBits) + e_SubBucketBits - 1;
+    uint64_t sub = bucket & ((1 << e_SubBucketBits) - 1);
+    return (sub | (1 << e_SubBucketBits)) << (msb - e_SubBucketBits);
+}
+
+struct MsgTypeStats
+{
+    std::atomic<uint64_t> m_count, m_bytes, m_parseNsec, m_fanout;
+    std::atomic<uint64_t> m_latency[e_NumLatencyBuckets];
+};
+
+static MsgTypeStats s_stats[e_NumStatsTypes];
+
+void DS::MsgStats_SetEnabled(bool enabled)
+{
+    s_msgStatsEnabled.store(enabled);
+}
+
+void DS::MsgStats_Reset()
+{
+    for (MsgTypeStats& stats : s_stats) {
+        stats.m_count = 0;
+        stats.m_bytes = 0;
+        stats.m_parseNsec = 0;
+        stats.m_fanout = 0;
+        for (auto& bucket : stats.m_latency)
+            bucket = 0;
+    }
+}
+
+void DS::MsgStats_Record(uint16_t type, size_t bytes, uint64_t parseNsec,
+                         size_t fanout, uint64_t latencyUsec)
+{
+    MsgTypeStats& stats = s_stats[stats_index(type)];
+    stats.m_count.fetch_add(1, std::memory_order_relaxed);
+    stats.m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    stats.m_parseNsec.fetch_add(parseNsec, std::memory_order_relaxed);
+    stats.m_fanout.fetch_add(fanout, std::memory_order_relaxed);
+    stats.m_latency[latency_bucket(latencyUsec)].fetch_add(1, std::memory_order_relaxed);
+}
+
+struct MsgStatsSummary
+{
+    uint64_t m_count, m_bytes, m_parseNsec, m_fanout;
+    uint64_t m_p50, m_p90, m_p99, m_max;
+};
+
+static MsgStatsSummary summarize(const MsgTypeStats& stats)
+{
+    MsgStatsSummary summary;
+    summary.m_count = stats.m_count.load(std::memory_order_relaxed);
+    summary.m_bytes = stats.m_bytes.load(std::memory_order_relaxed);
+    summary.m_parseNsec = stats.m_parseNsec.load(std::memory_order_relaxed);
+    summary.m_fanout = stats.m_fanout.load(std::memory_order_relaxed);
+
+    uint64_t buckets[e_NumLatencyBuckets];
+    uint64_t total = 0;
+    for (int i = 0; i < e_NumLatencyBuckets; ++i) {
+        buckets[i] = stats.m_latency[i].load(std::memory_order_relaxed);
+        total += buckets[i];
+    }
+
+    summary.m_p50 = summary.m_p90 = summary.m_p99 = summary.m_max = 0;
+    uint64_t seen = 0;
+    for (int i = 0; i < e_NumLatencyBuckets; ++i) {
+        if (!buckets[i])
+            continue;
+        uint64_t floor = latency_bucket_floor(i);
+        if (seen * 100 < total * 50 && (seen + buckets[i]) * 100 >= total * 50)
+            summary.m_p50 = floor;
+        if (seen * 100 < total * 90 && (seen + buckets[i]) * 100 >= total * 90)
+            summary.m_p90 = floor;
+        if (seen * 100 < total * 99 && (seen + buckets[i]) * 100 >= total * 99)
+            summary.m_p99 = floor;
+        summary.m_max = floor;
+        seen += buckets[i];
+    }
+    return summary;
+}
+
+void DS::MsgStats_Display()
+{
+    if (!MsgStats_Enabled())
+        fputs("Message stats are disabled; showing previously collected data\n", stdout);
+
+    ST::printf("{<28} {>10} {>12} {>10} {>10} {>9} {>9} {>9} {>9}\n",
+               "Type", "Count", "Bytes", "Parse us", "Fan-out", "p50 us",
+               "p90 us", "p99 us", "max us");
+    for (int i = 0; i < e_NumStatsTypes; ++i) {
+        MsgStatsSummary summary = summarize(s_stats[i]);
+        if (!summary.m_count)
+            continue;
+        ST::printf("{<28} {>10} {>12} {>10} {>10} {>9} {>9} {>9} {>9}\n",
+                   s_statsNames[i], summary.m_count, summary.m_bytes,
+                   summary.m_parseNsec / 1000 / summary.m_count,
+                   summary.m_fanout, summary.m_p50, summary.m_p90,
+                   summary.m_p99, summary.m_max);
+    }
+}
+
+ST::string DS::MsgStats_Json()
+{
+    ST::string_stream json;
+    json << "{\"enabled\":" << (MsgStats_Enabled() ? "true" : "false")
+         << ",\"types\":{";
+    bool first = true;
+    for (int i = 0; i < e_NumStatsTypes; ++i) {
+        MsgStatsSummary summary = summarize(s_stats[i]);
+        if (!summary.m_count)
+            continue;
+        if (!first)
+            json << ",";
+        first = false;
+        json << ST::format("\"{}\":{{\"count\":{},\"bytes\":{},\"parseNsec\":{},"
+                           "\"fanout\":{},\"latencyUsec\":{{\"p50\":{},\"p90\":{},"
+                           "\"p99\":{},\"max\":{}}}",
+                           s_statsNames[i], summary.m_count, summary.m_bytes,
+                           summary.m_parseNsec, summary.m_fanout, summary.m_p50,
+                           summary.m_p90, summary.m_p99, summary.m_max);
+    }
+    json << "}}";
+    return json.to_string();
+}
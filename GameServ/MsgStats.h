@@ -0,0 +1,47 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_MSGSTATS_H
+#define _DS_MSGSTATS_H
+
+#include <string_theory/string>
+#include <atomic>
+
+namespace DS
+{
+    extern std::atomic<bool> s_msgStatsEnabled;
+
+    // Checked before doing any timing, so disabled stats cost one load
+    inline bool MsgStats_Enabled()
+    {
+        return s_msgStatsEnabled.load(std::memory_order_relaxed);
+    }
+
+    void MsgStats_SetEnabled(bool enabled);
+    void MsgStats_Reset();
+
+    /* Records one game message, keyed by its creatable type.  `fanout` is
+     * the number of clients it was queued for, and `latencyUsec` is the
+     * time from receipt to the last of those sends. */
+    void MsgStats_Record(uint16_t type, size_t bytes, uint64_t parseNsec,
+                         size_t fanout, uint64_t latencyUsec);
+
+    void MsgStats_Display();
+    ST::string MsgStats_Json();
+}
+
+#endif
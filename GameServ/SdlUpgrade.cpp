@@ -0,0 +1,212 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+/* Upgrades stored SDL blobs to the latest descriptor versions, so game
+ * hosts don't have to upgrade them every time they load them.  Rows are
+ * streamed in, upgraded on a short-lived pool of their own, and each
+ * batch is written back in one transaction.  A row is only rewritten if
+ * it still holds the blob that was read, so a running host's newer save
+ * is never lost. */
+
+#include "GameServer_Private.h"
+#include "AuthServ/VaultTypes.h"
+#include "settings.h"
+#include <string_theory/codecs>
+#include <string_theory/format>
+
+struct SdlUpgradeRow
+{
+    ST::string m_idx;
+    ST::string m_blob;
+};
+
+struct SdlUpgradeProgress
+{
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    size_t m_pending, m_rows, m_upgraded, m_written, m_failed;
+
+    SdlUpgradeProgress()
+        : m_pending(), m_rows(), m_upgraded(), m_written(), m_failed() { }
+};
+
+static void upgrade_batch(const std::vector<SdlUpgradeRow>& rows, const char* update,
+                          SdlUpgradeProgress& progress)
+{
+    std::vector<std::pair<const SdlUpgradeRow*, ST::string>> upgraded;
+    size_t failed = 0;
+    for (const SdlUpgradeRow& row : rows) {
+        try {
+            DS::Blob blob = DS::Base64Decode(row.m_blob);
+            SDL::State state = SDL::State::FromBlob(blob);
+            if (!state.descriptor() || !state.update())
+                continue;
+            blob = state.toBlob();
+            upgraded.emplace_back(&row, ST::base64_encode(blob.buffer(), blob.size()));
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[SDL] Error upgrading state {}: {}\n", row.m_idx, ex.what());
+            ++failed;
+        }
+    }
+
+    size_t written = 0;
+    if (!upgraded.empty()) {
+        // Any error aborts the whole transaction, so the batch either lands
+        // completely or counts as failed
+        bool committed = false;
+        DS::PostgresPool::Lease postgres(s_gameDbPool);
+        if (postgres) {
+            DS::PGresultRef result = PQexec(postgres, "BEGIN");
+            committed = PQresultStatus(result) == PGRES_COMMAND_OK;
+            if (!committed)
+                PQ_PRINT_ERROR(postgres, BEGIN);
+            for (auto row = upgraded.begin(); committed && row != upgraded.end(); ++row) {
+                result = DS::PQexecVA(postgres, update, row->first->m_idx, row->second,
+                                      row->first->m_blob);
+                if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+                    PQ_PRINT_ERROR(postgres, UPDATE);
+                    result = PQexec(postgres, "ROLLBACK");
+                    committed = false;
+                } else {
+                    written += strtoul(PQcmdTuples(result), nullptr, 10);
+                }
+            }
+            if (committed) {
+                result = PQexec(postgres, "COMMIT");
+                if (PQresultStatus(result) != PGRES_COMMAND_OK) {
+                    PQ_PRINT_ERROR(postgres, COMMIT);
+                    committed = false;
+                }
+            }
+        }
+        if (!committed) {
+            written = 0;
+            failed += upgraded.size();
+        }
+    }
+
+    std::lock_guard<std::mutex> progressGuard(progress.m_mutex);
+    progress.m_rows += rows.size();
+    progress.m_upgraded += upgraded.size();
+    progress.m_written += written;
+    progress.m_failed += failed;
+    --progress.m_pending;
+    progress.m_changed.notify_all();
+}
+
+/* select must return the row's idx and its base64 blob.  update is given
+ * the idx, the upgraded blob and the blob that was read. */
+template <typename... ArgsT>
+static bool upgrade_table(DS::ThreadPool& pool, const char* table, const char* select,
+                          const char* update, ArgsT&&... args)
+{
+    static const size_t BATCH_SIZE = 256;
+
+    // Only a few batches are kept in flight, so memory use doesn't grow
+    // with the size of the table
+    const size_t maxPending = pool.size() * 2;
+    SdlUpgradeProgress progress;
+    auto submit_batch = [&](std::vector<SdlUpgradeRow>&& rows) {
+        std::unique_lock<std::mutex> progressLock(progress.m_mutex);
+        progress.m_changed.wait(progressLock, [&] { return progress.m_pending < maxPending; });
+        ++progress.m_pending;
+        progressLock.unlock();
+
+        auto batch = std::make_shared<std::vector<SdlUpgradeRow>>(std::move(rows));
+        pool.submit([batch, update, &progress] {
+            upgrade_batch(*batch, update, progress);
+        });
+    };
+
+    bool success = true;
+    {
+        DS::PostgresPool::Lease postgres(s_gameDbPool);
+        if (!postgres)
+            return false;
+
+        if (!DS::PQsendVA(postgres, select, std::forward<ArgsT>(args)...)) {
+            PQ_PRINT_ERROR(postgres, SELECT);
+            return false;
+        }
+        if (!PQsetSingleRowMode(postgres))
+            ST::printf(stderr, "[SDL] WARNING: Could not stream {} rows\n", table);
+
+        std::vector<SdlUpgradeRow> rows;
+        for ( ;; ) {
+            DS::PGresultRef result = PQgetResult(postgres);
+            if (!result)
+                break;
+            ExecStatusType status = PQresultStatus(result);
+            if (status != PGRES_SINGLE_TUPLE && status != PGRES_TUPLES_OK) {
+                PQ_PRINT_ERROR(postgres, SELECT);
+                success = false;
+                continue;
+            }
+
+            int count = PQntuples(result);
+            for (int i = 0; i < count; ++i) {
+                rows.push_back(SdlUpgradeRow { PQgetvalue(result, i, 0),
+                                               PQgetvalue(result, i, 1) });
+                if (rows.size() == BATCH_SIZE) {
+                    submit_batch(std::move(rows));
+                    rows.clear();
+                }
+            }
+        }
+        if (!rows.empty())
+            submit_batch(std::move(rows));
+    }
+
+    std::unique_lock<std::mutex> progressLock(progress.m_mutex);
+    progress.m_changed.wait(progressLock, [&] { return progress.m_pending == 0; });
+    ST::printf("{}: {} states, {} upgraded, {} written, {} failed\n", table,
+               progress.m_rows, progress.m_upgraded, progress.m_written, progress.m_failed);
+    return success && progress.m_failed == 0;
+}
+
+bool DS::GameServer_UpgradeSDL()
+{
+    if (!s_gameDbPool)
+        return false;
+
+    // Batches are written while the rows are still being read
+    const uint32_t connections = DS::Settings::GameDbConnections();
+    if (connections < 2) {
+        fputs("[SDL] Upgrading stored states needs at least 2 Game.DbConnections\n", stderr);
+        return false;
+    }
+
+    // The batches block on the database, so they don't run on the game host
+    // pool where they could park every worker and stall the live ages.  At
+    // most half of the connections the reader leaves over are used, so the
+    // hosts can still save their states during the upgrade.
+    size_t workers = std::min<size_t>(std::thread::hardware_concurrency(),
+                                      (connections - 1) / 2);
+    DS::ThreadPool pool(std::max<size_t>(workers, 1));
+
+    bool success = upgrade_table(pool, "AgeStates",
+            "SELECT idx, \"SdlBlob\" FROM game.\"AgeStates\"",
+            "UPDATE game.\"AgeStates\" SET \"SdlBlob\"=$2"
+            "    WHERE idx=$1 AND \"SdlBlob\"=$3");
+    success &= upgrade_table(pool, "SDL nodes",
+            "SELECT idx, \"Blob_1\" FROM vault.\"Nodes\""
+            "    WHERE \"NodeType\"=$1 AND \"Blob_1\" IS NOT NULL",
+            "UPDATE vault.\"Nodes\" SET \"Blob_1\"=$2"
+            "    WHERE idx=$1 AND \"Blob_1\"=$3",
+            static_cast<uint32_t>(DS::Vault::e_NodeSDL));
+    return success;
+}
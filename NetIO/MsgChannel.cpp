@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
+#include <iterator>
 #include "errors.h"
 
 DS::MsgChannel::~MsgChannel()
@@ -50,12 +51,13 @@ int DS::MsgChannel::fd()
 
 void DS::MsgChannel::putMessage(int type, void* payload)
 {
-    FifoMessage msg;
-    msg.m_messageType = type;
-    msg.m_payload = payload;
+    QueuedMessage msg;
+    msg.m_message.m_messageType = type;
+    msg.m_message.m_payload = payload;
+    msg.m_key = 0;
     {
         std::lock_guard<std::mutex> guard(m_mutex);
-        m_queue.push(msg);
+        m_queue.push_back(msg);
     }
 
     int result = eventfd_write(fd(), 1);
@@ -71,9 +73,45 @@ DS::FifoMessage DS::MsgChannel::getMessage()
         throw SystemError("Failed to read from event semaphore", strerror(errno));
 
     std::lock_guard<std::mutex> guard(m_mutex);
-    FifoMessage msg = m_queue.front();
-    m_queue.pop();
-    return msg;
+    QueuedMessage msg = m_queue.front();
+    m_queue.pop_front();
+    if (msg.m_key)
+        --m_keyed;
+    return msg.m_message;
+}
+
+void* DS::MsgChannel::putOrReplace(int type, void* payload, uint64_t key)
+{
+    QueuedMessage msg;
+    msg.m_message.m_messageType = type;
+    msg.m_message.m_payload = payload;
+    msg.m_key = key;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (key && m_keyed) {
+            // The most recent match is the only one there can be.  The new
+            // message still goes at the tail, so it can't overtake anything
+            // queued after the one it supersedes.  The queue stays the same
+            // length, so the semaphore count is already right.
+            for (auto it = m_queue.rbegin(); it != m_queue.rend(); ++it) {
+                if (it->m_key == key && it->m_message.m_messageType == type) {
+                    void* stale = it->m_message.m_payload;
+                    m_queue.erase(std::next(it).base());
+                    m_queue.push_back(msg);
+                    return stale;
+                }
+            }
+        }
+
+        m_queue.push_back(msg);
+        if (key)
+            ++m_keyed;
+    }
+
+    int result = eventfd_write(fd(), 1);
+    if (result < 0)
+        throw SystemError("Failed to write to event semaphore", strerror(errno));
+    return nullptr;
 }
 
 bool DS::MsgChannel::hasMessage()
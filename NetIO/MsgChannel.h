@@ -18,7 +18,7 @@
 #ifndef _DS_MSGCHANNEL_H
 #define _DS_MSGCHANNEL_H
 
-#include <queue>
+#include <deque>
 #include <mutex>
 
 namespace DS
@@ -32,7 +32,7 @@ namespace DS
     class MsgChannel
     {
     public:
-        MsgChannel() : m_semaphore(-1) { }
+        MsgChannel() : m_semaphore(-1), m_keyed() { }
         ~MsgChannel();
 
         int fd();
@@ -40,10 +40,23 @@ namespace DS
         FifoMessage getMessage();
         bool hasMessage();
 
+        /* Queues a message, dropping a still-queued message with the same
+         * type and non-zero coalescing key if there is one.  Returns the
+         * dropped payload for the caller to release, or nullptr if nothing
+         * was dropped. */
+        void* putOrReplace(int type, void* payload, uint64_t key);
+
     private:
+        struct QueuedMessage
+        {
+            FifoMessage m_message;
+            uint64_t m_key;
+        };
+
         int m_semaphore;
         std::mutex m_mutex;
-        std::queue<FifoMessage> m_queue;
+        std::deque<QueuedMessage> m_queue;
+        size_t m_keyed;
     };
 }
 
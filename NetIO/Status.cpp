@@ -19,6 +19,8 @@
 #include "SockIO.h"
 #include "errors.h"
 #include "settings.h"
+#include "GameServ/MsgStats.h"
+#include "GameServ/GameServer.h"
 #include <cstdio>
 #include <list>
 #include <thread>
@@ -27,8 +29,19 @@
 static std::thread s_httpThread;
 static DS::SocketHandle s_listenSock;
 
-#define SEND_RAW(sock, str) \
-    DS::SendBuffer((sock), static_cast<const void*>(str), strlen(str))
+static void send_http_response(DS::SocketHandle client, const char* contentType,
+                               const ST::string& body, const char* status = "200 OK")
+{
+    ST::string header = ST::format("HTTP/1.1 {}\r\n"
+                                   "Server: Dirtsand\r\n"
+                                   "Connection: close\r\n"
+                                   "Accept-Ranges: bytes\r\n"
+                                   "Content-Length: {}\r\n"
+                                   "Content-Type: {}\r\n"
+                                   "\r\n", status, body.size(), contentType);
+    DS::SendBuffer(client, header.c_str(), header.size());
+    DS::SendBuffer(client, body.c_str(), body.size());
+}
 
 void dm_htserv()
 {
@@ -123,44 +136,22 @@ void dm_htserv()
                 json += "}\r\n";
                 // TODO: Add more status fields (players/ages, etc)
 
-                SEND_RAW(client, "HTTP/1.1 200 OK\r\n");
-                SEND_RAW(client, "Server: Dirtsand\r\n");
-                SEND_RAW(client, "Connection: close\r\n");
-                SEND_RAW(client, "Accept-Ranges: bytes\r\n");
-                ST::string lengthParam = ST::format("Content-Length: {}\r\n", json.size());
-                DS::SendBuffer(client, lengthParam.c_str(), lengthParam.size());
-                SEND_RAW(client, "Content-Type: application/json\r\n");
-                SEND_RAW(client, "\r\n");
-                DS::SendBuffer(client, json.c_str(), json.size());
-                DS::FreeSock(client);
+                send_http_response(client, "application/json", json);
+            } else if (path == "/msgstats") {
+                send_http_response(client, "application/json", DS::MsgStats_Json() + "\r\n");
+            } else if (path == "/population") {
+                send_http_response(client, "application/json",
+                                   DS::GameServer_PopulationJson() + "\r\n");
             } else if (path == "/welcome") {
                 ST::string welcome = DS::Settings::WelcomeMsg();
                 welcome = welcome.replace("\\n", "\r\n");
-
-                SEND_RAW(client, "HTTP/1.1 200 OK\r\n");
-                SEND_RAW(client, "Server: Dirtsand\r\n");
-                SEND_RAW(client, "Connection: close\r\n");
-                SEND_RAW(client, "Accept-Ranges: bytes\r\n");
-                ST::string lengthParam = ST::format("Content-Length: {}\r\n", welcome.size());
-                DS::SendBuffer(client, lengthParam.c_str(), lengthParam.size());
-                SEND_RAW(client, "Content-Type: text/plain\r\n");
-                SEND_RAW(client, "\r\n");
-                DS::SendBuffer(client, welcome.c_str(), welcome.size());
-                DS::FreeSock(client);
+                send_http_response(client, "text/plain", welcome);
             } else {
-                ST::string content = ST::format("No page found at {}\r\n", path);
-
-                SEND_RAW(client, "HTTP/1.1 404 NOT FOUND\r\n");
-                SEND_RAW(client, "Server: Dirtsand\r\n");
-                SEND_RAW(client, "Connection: close\r\n");
-                SEND_RAW(client, "Accept-Ranges: bytes\r\n");
-                ST::string lengthParam = ST::format("Content-Length: {}\r\n", content.size());
-                DS::SendBuffer(client, lengthParam.c_str(), lengthParam.size());
-                SEND_RAW(client, "Content-Type: text/plain\r\n");
-                SEND_RAW(client, "\r\n");
-                DS::SendBuffer(client, content.c_str(), content.size());
-                DS::FreeSock(client);
+                send_http_response(client, "text/plain",
+                                   ST::format("No page found at {}\r\n", path),
+                                   "404 NOT FOUND");
             }
+            DS::FreeSock(client);
         } catch (const std::exception& ex) {
             ST::printf(stderr, "[Status] Exception occurred serving HTTP to {}: {}\n",
                        DS::SockIpAddress(client), ex.what());
@@ -0,0 +1,185 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "ThreadPool.h"
+
+#include <string_theory/stdio>
+
+static thread_local DS::ThreadPool* s_currentPool = nullptr;
+static thread_local size_t s_currentQueue = 0;
+
+DS::ThreadPool::ThreadPool(size_t threads)
+    : m_next(0), m_pending(0), m_idle(0), m_blocked(0), m_spares(0),
+      m_shutdown(false)
+{
+    if (threads == 0)
+        threads = 1;
+
+    m_queues.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        m_queues.emplace_back(new WorkQueue);
+
+    m_threads.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        m_threads.emplace_back(&ThreadPool::work, this, i, false);
+}
+
+DS::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_shutdown = true;
+    }
+    m_cond.notify_all();
+
+    for (std::thread& thread : m_threads)
+        thread.join();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this] { return m_spares == 0; });
+    reap();
+}
+
+void DS::ThreadPool::reap()
+{
+    // Only called with m_mutex held, so retired spares are already past
+    // their last use of the pool
+    for (std::thread::id id : m_retired) {
+        for (auto it = m_spareThreads.begin(); it != m_spareThreads.end(); ++it) {
+            if (it->get_id() == id) {
+                it->join();
+                m_spareThreads.erase(it);
+                break;
+            }
+        }
+    }
+    m_retired.clear();
+}
+
+void DS::ThreadPool::submit(Task task)
+{
+    // Tasks submitted from a worker stay on its own queue, where they are
+    // cheapest to pick up; everything else is spread across the workers.
+    size_t index = (s_currentPool == this) ? s_currentQueue
+                                           : m_next++ % m_queues.size();
+    {
+        std::lock_guard<std::mutex> guard(m_queues[index]->m_mutex);
+        m_queues[index]->m_tasks.push_back(std::move(task));
+    }
+
+    ++m_pending;
+    if (m_idle > 0) {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_cond.notify_one();
+    }
+}
+
+bool DS::ThreadPool::take(size_t home, Task& task)
+{
+    {
+        WorkQueue& queue = *m_queues[home];
+        std::lock_guard<std::mutex> guard(queue.m_mutex);
+        if (!queue.m_tasks.empty()) {
+            task = std::move(queue.m_tasks.front());
+            queue.m_tasks.pop_front();
+            --m_pending;
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < m_queues.size(); ++i) {
+        WorkQueue& victim = *m_queues[(home + i) % m_queues.size()];
+        std::lock_guard<std::mutex> guard(victim.m_mutex);
+        if (!victim.m_tasks.empty()) {
+            task = std::move(victim.m_tasks.back());
+            victim.m_tasks.pop_back();
+            --m_pending;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DS::ThreadPool::work(size_t home, bool spare)
+{
+    s_currentPool = this;
+    s_currentQueue = home;
+
+    // A spare is no longer needed once another unblocked thread is around
+    auto redundant = [this, spare] {
+        return spare && m_queues.size() + m_spares - m_blocked > 1;
+    };
+
+    for ( ;; ) {
+        Task task;
+        if (take(home, task)) {
+            try {
+                task();
+            } catch (const std::exception& ex) {
+                ST::printf(stderr, "[ThreadPool] Uncaught exception in task: {}\n",
+                           ex.what());
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_shutdown || redundant()) {
+            if (spare) {
+                --m_spares;
+                m_retired.push_back(std::this_thread::get_id());
+                m_cond.notify_all();
+            }
+            return;
+        }
+
+        ++m_idle;
+        m_cond.wait(lock, [this, &redundant] {
+            return m_pending > 0 || m_shutdown || redundant();
+        });
+        --m_idle;
+    }
+}
+
+DS::ThreadPool::BlockingScope::BlockingScope()
+    : m_pool(s_currentPool)
+{
+    if (!m_pool)
+        return;
+
+    std::lock_guard<std::mutex> guard(m_pool->m_mutex);
+    ++m_pool->m_blocked;
+    if (m_pool->m_blocked == m_pool->m_queues.size() + m_pool->m_spares
+            && !m_pool->m_shutdown) {
+        m_pool->reap();
+        ++m_pool->m_spares;
+        m_pool->m_spareThreads.emplace_back(&ThreadPool::work, m_pool,
+                                            s_currentQueue, true);
+    }
+}
+
+DS::ThreadPool::BlockingScope::~BlockingScope()
+{
+    if (!m_pool)
+        return;
+
+    {
+        std::lock_guard<std::mutex> guard(m_pool->m_mutex);
+        --m_pool->m_blocked;
+    }
+    m_pool->m_cond.notify_all();
+}
@@ -0,0 +1,91 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_THREADPOOL_H
+#define _DS_THREADPOOL_H
+
+#include <functional>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <list>
+#include <mutex>
+
+namespace DS
+{
+    /* Fixed-size work-stealing thread pool.  Each worker owns a task queue;
+     * idle workers steal from the others before going to sleep. */
+    class ThreadPool
+    {
+    public:
+        typedef std::function<void ()> Task;
+
+        explicit ThreadPool(size_t threads);
+        ~ThreadPool();
+
+        void submit(Task task);
+        size_t size() const { return m_queues.size(); }
+
+        /* Marks the current worker as blocked on another daemon for the
+         * lifetime of the object.  If every worker is blocked, a spare
+         * thread is started so queued tasks (including the ones the other
+         * daemon may be waiting on) can still make progress.  Does nothing
+         * when not called from a pool thread. */
+        class BlockingScope
+        {
+        public:
+            BlockingScope();
+            ~BlockingScope();
+
+            BlockingScope(const BlockingScope&) = delete;
+            BlockingScope& operator=(const BlockingScope&) = delete;
+
+        private:
+            ThreadPool* m_pool;
+        };
+
+    private:
+        struct WorkQueue
+        {
+            std::mutex m_mutex;
+            std::deque<Task> m_tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkQueue>> m_queues;
+        std::vector<std::thread> m_threads;
+        std::atomic<size_t> m_next;
+        std::atomic<size_t> m_pending;
+        std::atomic<size_t> m_idle;
+
+        // Guards sleeping, shutdown and the spare thread bookkeeping
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        size_t m_blocked, m_spares;
+        std::list<std::thread> m_spareThreads;
+        std::vector<std::thread::id> m_retired;
+        bool m_shutdown;
+
+        bool take(size_t home, Task& task);
+        void work(size_t home, bool spare);
+        void reap();
+    };
+}
+
+#endif
@@ -25,6 +25,8 @@ namespace MOUL
     class ArmatureBrain : public Creatable
     {
     public:
+        ABSTRACT_CREATABLE(ArmatureBrain)
+
         void read(DS::Stream* stream) override;
         void write(DS::Stream* stream) const override;
 
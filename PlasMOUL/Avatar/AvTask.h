@@ -25,6 +25,8 @@ namespace MOUL
     class AvTask : public Creatable
     {
     public:
+        ABSTRACT_CREATABLE(AvTask)
+
         virtual bool makeSafeForNet() { return true; }
 
     protected:
@@ -27,6 +27,8 @@ namespace MOUL
     class Message : public Creatable
     {
     public:
+        ABSTRACT_CREATABLE(Message)
+
         enum BCastFlags
         {
             e_BCastByType               = (1<<0),
@@ -31,6 +31,8 @@ namespace MOUL
     class NetMessage : public Creatable
     {
     public:
+        ABSTRACT_CREATABLE(NetMessage)
+
         enum ContentFlags
         {
             e_HasTimeSent               = (1<<0),
@@ -26,7 +26,8 @@ void MOUL::NetMsgGameMessage::read(DS::Stream* stream)
     msgStream.read(stream);
     m_compression = msgStream.m_compression;
     Creatable::SafeUnref(m_message);
-    m_message = Factory::Read<Message>(&msgStream.m_stream);
+    DS::BlobStream msgData(msgStream.m_data);
+    m_message = Factory::Read<Message>(&msgData);
 
     if (stream->read<bool>())
         m_deliveryTime.read(stream);
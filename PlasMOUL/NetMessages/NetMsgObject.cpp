@@ -17,55 +17,211 @@
 
 #include "NetMsgObject.h"
 #include "errors.h"
-#include <zlib.h>
 #include <memory>
+#include <vector>
+#include <atomic>
+#ifdef DS_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#else
+#include <zlib.h>
+#endif
+
+namespace
+{
+    /* Per-thread codec state and output scratch space, reused for every
+     * message instead of being set up and torn down by each one-shot
+     * compress()/uncompress() call. */
+    class CodecContext
+    {
+    public:
+        CodecContext() : m_inflater(), m_deflater() { }
+        ~CodecContext();
+
+        bool inflate(uint8_t* dest, size_t destSize, const uint8_t* src, size_t srcSize);
+
+        /* Returns the compressed size in output(), or 0 on failure */
+        size_t deflate(const uint8_t* src, size_t srcSize);
+        const uint8_t* output() const { return m_output.data(); }
+
+    private:
+#ifdef DS_HAVE_LIBDEFLATE
+        libdeflate_decompressor* m_inflater;
+        libdeflate_compressor* m_deflater;
+#else
+        z_stream* m_inflater;
+        z_stream* m_deflater;
+#endif
+        std::vector<uint8_t> m_output;
+    };
+
+#ifdef DS_HAVE_LIBDEFLATE
+    CodecContext::~CodecContext()
+    {
+        if (m_inflater)
+            libdeflate_free_decompressor(m_inflater);
+        if (m_deflater)
+            libdeflate_free_compressor(m_deflater);
+    }
+
+    bool CodecContext::inflate(uint8_t* dest, size_t destSize, const uint8_t* src,
+                               size_t srcSize)
+    {
+        if (!m_inflater) {
+            m_inflater = libdeflate_alloc_decompressor();
+            if (!m_inflater)
+                throw std::bad_alloc();
+        }
+        // Without an actual_out, anything but exactly destSize bytes fails
+        return libdeflate_zlib_decompress(m_inflater, src, srcSize, dest, destSize,
+                                          nullptr) == LIBDEFLATE_SUCCESS;
+    }
+
+    size_t CodecContext::deflate(const uint8_t* src, size_t srcSize)
+    {
+        if (!m_deflater) {
+            m_deflater = libdeflate_alloc_compressor(6);
+            if (!m_deflater)
+                throw std::bad_alloc();
+        }
+        size_t bound = libdeflate_zlib_compress_bound(m_deflater, srcSize);
+        if (m_output.size() < bound)
+            m_output.resize(bound);
+        return libdeflate_zlib_compress(m_deflater, src, srcSize, m_output.data(),
+                                        m_output.size());
+    }
+#else
+    CodecContext::~CodecContext()
+    {
+        if (m_inflater) {
+            inflateEnd(m_inflater);
+            delete m_inflater;
+        }
+        if (m_deflater) {
+            deflateEnd(m_deflater);
+            delete m_deflater;
+        }
+    }
+
+    bool CodecContext::inflate(uint8_t* dest, size_t destSize, const uint8_t* src,
+                               size_t srcSize)
+    {
+        if (!m_inflater) {
+            std::unique_ptr<z_stream> zs(new z_stream());
+            if (inflateInit(zs.get()) != Z_OK)
+                throw std::bad_alloc();
+            m_inflater = zs.release();
+        } else if (inflateReset(m_inflater) != Z_OK) {
+            return false;
+        }
+        m_inflater->next_in = const_cast<Bytef*>(src);
+        m_inflater->avail_in = srcSize;
+        m_inflater->next_out = dest;
+        m_inflater->avail_out = destSize;
+        // A stream which ends early would leave the rest of dest unwritten
+        return ::inflate(m_inflater, Z_FINISH) == Z_STREAM_END
+                && m_inflater->total_out == destSize;
+    }
+
+    size_t CodecContext::deflate(const uint8_t* src, size_t srcSize)
+    {
+        if (!m_deflater) {
+            std::unique_ptr<z_stream> zs(new z_stream());
+            if (deflateInit(zs.get(), Z_DEFAULT_COMPRESSION) != Z_OK)
+                throw std::bad_alloc();
+            m_deflater = zs.release();
+        } else if (deflateReset(m_deflater) != Z_OK) {
+            return 0;
+        }
+        size_t bound = deflateBound(m_deflater, srcSize);
+        if (m_output.size() < bound)
+            m_output.resize(bound);
+        m_deflater->next_in = const_cast<Bytef*>(src);
+        m_deflater->avail_in = srcSize;
+        m_deflater->next_out = m_output.data();
+        m_deflater->avail_out = m_output.size();
+        if (::deflate(m_deflater, Z_FINISH) != Z_STREAM_END)
+            return 0;
+        return m_deflater->total_out;
+    }
+#endif
+
+    thread_local CodecContext s_codec;
+    std::atomic<size_t> s_compressThreshold(0);
+}
+
+void MOUL::NetMsgStream::SetCompressThreshold(size_t threshold)
+{
+    s_compressThreshold.store(threshold, std::memory_order_relaxed);
+}
+
+size_t MOUL::NetMsgStream::CompressThreshold()
+{
+    return s_compressThreshold.load(std::memory_order_relaxed);
+}
 
 void MOUL::NetMsgStream::read(DS::Stream* stream)
 {
     uint32_t uncompressedSize = stream->read<uint32_t>();
     m_compression = stream->read<Compression, uint8_t>();
     uint32_t size = stream->read<uint32_t>();
-    std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
-    stream->readBytes(buffer.get(), size);
 
     if (m_compression == e_CompressZlib) {
-        if (size < 2)
+        if (size < 2 || uncompressedSize < 2)
             throw DS::MalformedData();
 
+        DS::Blob buffer = stream->readBlob(size);
         std::unique_ptr<uint8_t[]> zbuf(new uint8_t[uncompressedSize]);
-        uLongf zlength = uncompressedSize - 2;
-        memcpy(zbuf.get(), buffer.get(), 2);
-        int result = uncompress(zbuf.get() + 2, &zlength, buffer.get() + 2, size - 2);
-        if (result != Z_OK)
+        memcpy(zbuf.get(), buffer.buffer(), 2);
+        if (!s_codec.inflate(zbuf.get() + 2, uncompressedSize - 2,
+                             buffer.buffer() + 2, size - 2))
             throw DS::MalformedData();
-        m_stream.steal(zbuf.release(), uncompressedSize);
+        m_data = DS::Blob::Steal(zbuf.release(), uncompressedSize);
     } else {
-        m_stream.steal(buffer.release(), size);
+        m_data = stream->readBlob(size);
     }
 }
 
 void MOUL::NetMsgStream::write(DS::Stream* stream) const
 {
-    stream->write<uint32_t>(m_stream.size());
-    stream->write<Compression, uint8_t>(m_compression);
+    Write(stream, m_compression, m_stream.buffer(), m_stream.size());
+}
 
-    if (m_compression == e_CompressZlib) {
-        if (m_stream.size() < 2)
+void MOUL::NetMsgStream::Write(DS::Stream* stream, Compression compression,
+                               const uint8_t* data, size_t size)
+{
+    // Large payloads are worth compressing even if the sender didn't
+    bool byPolicy = false;
+    size_t threshold = CompressThreshold();
+    if (compression == e_CompressNone && threshold && size >= threshold) {
+        compression = e_CompressZlib;
+        byPolicy = true;
+    }
+
+    if (compression == e_CompressZlib) {
+        if (size < 2)
             throw DS::MalformedData();
 
-        uLongf zlength = compressBound(m_stream.size() - 2);
-        std::unique_ptr<uint8_t[]> zbuf(new uint8_t[zlength + 2]);
-        memcpy(zbuf.get(), m_stream.buffer(), 2);
-        int result = compress(zbuf.get() + 2, &zlength, m_stream.buffer() + 2,
-                              m_stream.size() - 2);
-        if (result != Z_OK)
+        // The first two bytes (the creatable type) are never compressed
+        size_t zlength = s_codec.deflate(data + 2, size - 2);
+        if (zlength == 0)
             throw DS::MalformedData();
-        stream->write<uint32_t>(zlength + 2);
-        stream->writeBytes(zbuf.get(), zlength + 2);
-    } else {
-        stream->write<uint32_t>(m_stream.size());
-        stream->writeBytes(m_stream.buffer(), m_stream.size());
+        if (!byPolicy || zlength + 2 < size) {
+            stream->write<uint32_t>(size);
+            stream->write<Compression, uint8_t>(e_CompressZlib);
+            stream->write<uint32_t>(zlength + 2);
+            stream->writeBytes(data, 2);
+            stream->writeBytes(s_codec.output(), zlength);
+            return;
+        }
+
+        // Didn't help; send it as-is, marked the same way the client does
+        compression = e_CompressFail;
     }
+
+    stream->write<uint32_t>(size);
+    stream->write<Compression, uint8_t>(compression);
+    stream->write<uint32_t>(size);
+    stream->writeBytes(data, size);
 }
 
 void MOUL::NetMsgObject::read(DS::Stream* stream)
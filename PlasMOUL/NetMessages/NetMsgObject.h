@@ -33,10 +33,23 @@ namespace MOUL
         NetMsgStream(Compression compress = e_CompressNone)
             : m_compression(compress) { }
 
+        /* Reads the (decompressed) payload into m_data.  Uncompressed
+         * payloads read from a shared Blob are views, not copies. */
         void read(DS::Stream* stream);
+
+        /* Writes the contents of m_stream */
         void write(DS::Stream* stream) const;
 
+        static void Write(DS::Stream* stream, Compression compression,
+                          const uint8_t* data, size_t size);
+
+        /* Uncompressed payloads of at least this many bytes are written
+         * with zlib compression (0 = only when the message asks for it) */
+        static void SetCompressThreshold(size_t threshold);
+        static size_t CompressThreshold();
+
         Compression m_compression;
+        DS::Blob m_data;
         DS::BufferStream m_stream;
     };
 
@@ -24,9 +24,7 @@ void MOUL::NetMsgSDLState::read(DS::Stream* stream)
     NetMsgStream blobStream;
     blobStream.read(stream);
     m_compression = blobStream.m_compression;
-    uint8_t* sdl = new uint8_t[blobStream.m_stream.size()];
-    memcpy(sdl, blobStream.m_stream.buffer(), blobStream.m_stream.size());
-    m_sdlBlob = DS::Blob::Steal(sdl, blobStream.m_stream.size());
+    m_sdlBlob = std::move(blobStream.m_data);
 
     m_isInitial = stream->read<bool>();
     m_persistOnServer = stream->read<bool>();
@@ -37,9 +35,7 @@ void MOUL::NetMsgSDLState::write(DS::Stream* stream) const
 {
     NetMsgObject::write(stream);
 
-    NetMsgStream blobStream(m_compression);
-    blobStream.m_stream.writeBytes(m_sdlBlob.buffer(), m_sdlBlob.size());
-    blobStream.write(stream);
+    NetMsgStream::Write(stream, m_compression, m_sdlBlob.buffer(), m_sdlBlob.size());
 
     stream->write<bool>(m_isInitial);
     stream->write<bool>(m_persistOnServer);
@@ -95,16 +95,17 @@ void MOUL::NetMsgSharedState::read(DS::Stream* stream)
     m_compression = msgStream.m_compression;
 
     // Read the state
-    m_stateName = msgStream.m_stream.readPString<uint16_t>(DS::e_StringUTF8);
-    m_vars.resize(msgStream.m_stream.read<uint32_t>());
-    m_serverMayDelete = msgStream.m_stream.read<bool>();
+    DS::BlobStream stateStream(msgStream.m_data);
+    m_stateName = stateStream.readPString<uint16_t>(DS::e_StringUTF8);
+    m_vars.resize(stateStream.read<uint32_t>());
+    m_serverMayDelete = stateStream.read<bool>();
 
     for (size_t i=0; i<m_vars.size(); ++i)
-        m_vars[i].read(&msgStream.m_stream);
-    if (!msgStream.m_stream.atEof()) {
+        m_vars[i].read(&stateStream);
+    if (!stateStream.atEof()) {
         ST::printf(stderr, "WARNING: {} bytes left over in stream after parsing "
                            "NetMsgSharedState state variables\n",
-                   msgStream.m_stream.size() - msgStream.m_stream.tell());
+                   stateStream.size() - stateStream.tell());
     }
 
     m_lockRequest = stream->read<uint8_t>();
@@ -25,9 +25,7 @@ void MOUL::NetMsgVoice::read(DS::Stream* stream)
     m_frames = stream->read<uint8_t>();
 
     size_t length = stream->read<uint16_t>();
-    uint8_t* buffer = new uint8_t[length];
-    stream->readBytes(buffer, length);
-    m_data = DS::Blob::Steal(buffer, length);
+    m_data = stream->readBlob(length);
 
     m_receivers.resize(stream->read<uint8_t>());
     for (size_t i=0; i<m_receivers.size(); ++i)
@@ -20,10 +20,32 @@
 
 #include "config.h"
 #include "streams.h"
+#include <new>
+#include <type_traits>
 
+#define CREATABLE_CLASS(type) \
+    typedef type CreatableSelf; \
+    enum { CreatableClass = CLASS_##type };
+
+/* For abstract creatables listed in creatable_bases.inl */
+#define ABSTRACT_CREATABLE(type) \
+    CREATABLE_CLASS(type)
+
+#ifdef DS_NO_CREATABLE_POOL
+#define FACTORY_CREATABLE(type) \
+    protected: friend class Factory; \
+    public: CREATABLE_CLASS(type) \
+        static type* Create() { return new type(ID_##type); }
+#else
 #define FACTORY_CREATABLE(type) \
     protected: friend class Factory; \
-    public: static type* Create() { return new type(ID_##type); }
+    public: CREATABLE_CLASS(type) \
+        static type* Create() { return new type(ID_##type); } \
+        static void* operator new(size_t size) \
+        { return CreatablePool<sizeof(type)>::Alloc(size); } \
+        static void operator delete(void* ptr, size_t size) \
+        { CreatablePool<sizeof(type)>::Free(ptr, size); }
+#endif
 
 namespace MOUL
 {
@@ -36,14 +58,102 @@ namespace MOUL
     #undef CREATABLE_TYPE
     };
 
+    /* Dense index of every class Creatable::Cast can target */
+    enum CreatableClasses
+    {
+    #define CREATABLE_TYPE(id, cre) \
+        CLASS_##cre,
+    #include "creatable_types.inl"
+    #undef CREATABLE_TYPE
+    #define CREATABLE_BASE(cre) \
+        CLASS_##cre,
+    #include "creatable_bases.inl"
+    #undef CREATABLE_BASE
+        e_NumCreatableClasses
+    };
+
+    /* Per-thread cache of freed creatable storage.  Every FACTORY_CREATABLE
+     * type gets one keyed by its size, so steady-state message traffic
+     * recycles the objects themselves instead of going to the heap.  Storage
+     * freed on a different thread than it was allocated on simply migrates
+     * to that thread's list; each list is capped so an idle thread can't
+     * hoard more than a handful of blocks. */
+    template <size_t block_size>
+    class CreatablePool
+    {
+    public:
+        enum { e_MaxFreeBlocks = 256 };
+
+        static void* Alloc(size_t size)
+        {
+            FreeList& list = s_freeList;
+            if (size != block_size || !list.m_head)
+                return ::operator new(size);
+            Block* block = list.m_head;
+            list.m_head = block->m_next;
+            --list.m_count;
+            return block;
+        }
+
+        static void Free(void* ptr, size_t size)
+        {
+            FreeList& list = s_freeList;
+            if (size != block_size || list.m_count >= e_MaxFreeBlocks) {
+                ::operator delete(ptr);
+                return;
+            }
+            Block* block = static_cast<Block*>(ptr);
+            block->m_next = list.m_head;
+            list.m_head = block;
+            ++list.m_count;
+        }
+
+    private:
+        struct Block { Block* m_next; };
+        static_assert(block_size >= sizeof(Block), "Creatable too small to pool");
+
+        struct FreeList
+        {
+            Block* m_head = nullptr;
+            size_t m_count = 0;
+
+            ~FreeList()
+            {
+                while (m_head) {
+                    Block* next = m_head->m_next;
+                    ::operator delete(m_head);
+                    m_head = next;
+                }
+                /* Anything released later during thread teardown goes
+                 * straight back to the heap */
+                m_count = e_MaxFreeBlocks;
+            }
+        };
+
+        static thread_local FreeList s_freeList;
+    };
+
+    template <size_t block_size>
+    thread_local typename CreatablePool<block_size>::FreeList
+            CreatablePool<block_size>::s_freeList;
+
     class Creatable
     {
     public:
+        /* Checks the type ID against the inheritance table generated from
+         * creatable_types.inl, rather than going through RTTI */
         template <class cre_t> cre_t* Cast()
-        { return dynamic_cast<cre_t*>(this); }
+        {
+            static_assert(std::is_same<typename cre_t::CreatableSelf, cre_t>::value,
+                          "Cast target must be a FACTORY_CREATABLE or ABSTRACT_CREATABLE");
+            return IsA(m_type, cre_t::CreatableClass)
+                   ? static_cast<cre_t*>(this) : nullptr;
+        }
 
         template <class cre_t> const cre_t* Cast() const
-        { return dynamic_cast<const cre_t*>(this); }
+        { return const_cast<Creatable*>(this)->Cast<cre_t>(); }
+
+        static bool IsA(uint16_t type, unsigned creatableClass);
 
         uint16_t type() const { return m_type; }
 
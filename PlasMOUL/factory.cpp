@@ -95,3 +95,51 @@ void MOUL::Factory::WriteCreatable(DS::Stream* stream, const MOUL::Creatable* ob
         stream->write<uint16_t>(0x8000);
     }
 }
+
+namespace
+{
+    struct ClassMask
+    {
+        uint64_t m_bits[(MOUL::e_NumCreatableClasses + 63) / 64];
+
+        constexpr void set(unsigned cls) { m_bits[cls / 64] |= uint64_t(1) << (cls % 64); }
+        constexpr bool test(unsigned cls) const
+        { return (m_bits[cls / 64] >> (cls % 64)) & 1; }
+    };
+
+    /* Every class (concrete or abstract) that cre_t derives from */
+    template <class cre_t>
+    constexpr ClassMask ancestors()
+    {
+        ClassMask mask {};
+#define CREATABLE_TYPE(id, cre) \
+        if (std::is_base_of<MOUL::cre, cre_t>::value) \
+            mask.set(MOUL::CLASS_##cre);
+#include "creatable_types.inl"
+#undef CREATABLE_TYPE
+#define CREATABLE_BASE(cre) \
+        if (std::is_base_of<MOUL::cre, cre_t>::value) \
+            mask.set(MOUL::CLASS_##cre);
+#include "creatable_bases.inl"
+#undef CREATABLE_BASE
+        return mask;
+    }
+
+    constexpr ClassMask s_ancestors[] = {
+#define CREATABLE_TYPE(id, cre) \
+        ancestors<MOUL::cre>(),
+#include "creatable_types.inl"
+#undef CREATABLE_TYPE
+    };
+}
+
+bool MOUL::Creatable::IsA(uint16_t type, unsigned creatableClass)
+{
+    switch (type) {
+#define CREATABLE_TYPE(id, cre) \
+    case id: return s_ancestors[CLASS_##cre].test(creatableClass);
+#include "creatable_types.inl"
+#undef CREATABLE_TYPE
+    default: return false;
+    }
+}
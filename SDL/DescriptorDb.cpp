@@ -18,7 +18,10 @@
 #include "DescriptorDb.h"
 #include "SdlParser.h"
 #include "errors.h"
+#include "NetIO/ThreadPool.h"
 #include <string_theory/format>
+#include <algorithm>
+#include <memory>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -28,54 +31,434 @@ static int sel_sdl(const dirent* de)
     return strcmp(strrchr(de->d_name, '.'), ".sdl") == 0;
 }
 
-SDL::DescriptorDb::descmap_t SDL::DescriptorDb::s_descriptors;
+// Generation 0 is empty, so lookups before the first load just fail
+SDL::DescriptorDb::Snapshot SDL::DescriptorDb::s_empty;
+std::atomic<SDL::DescriptorDb::Snapshot*> SDL::DescriptorDb::s_current(&s_empty);
+std::atomic<size_t> SDL::DescriptorDb::s_leasing;
+std::mutex SDL::DescriptorDb::s_loadMutex;
+std::vector<std::unique_ptr<SDL::DescriptorDb::Snapshot>> SDL::DescriptorDb::s_generations;
+std::unordered_map<ST::string, uint32_t, ST::hash_i, ST::equal_i> SDL::DescriptorDb::s_ids;
 
-bool SDL::DescriptorDb::LoadDescriptorsFromFile(const ST::string& filename)
+static const uint32_t CACHE_MAGIC = 0x43534453;     // "SDSC"
+static const uint32_t CACHE_VERSION = 1;
+
+/* The cache is only valid for exactly the set of files it was built from */
+struct SdlFileInfo
 {
-    SDL::Parser parser;
-    if (parser.open(filename.c_str())) {
-        std::list<StateDescriptor> descriptors = parser.parse();
-        for (auto it = descriptors.begin(); it != descriptors.end(); ++it) {
-#ifdef DEBUG
-            descmap_t::iterator namei = s_descriptors.find(it->m_name);
-            if (namei != s_descriptors.end()) {
-                if (namei->second.find(it->m_version) != namei->second.end()) {
-                    ST::printf(stderr, "[SDL] Warning: Duplicate descriptor version for {}\n",
-                               it->m_name);
-                }
+    ST::string m_filename;
+    uint64_t m_size;
+    int64_t m_mtime, m_mtimeNsec;
+
+    bool operator==(const SdlFileInfo& other) const
+    {
+        return m_filename == other.m_filename && m_size == other.m_size
+            && m_mtime == other.m_mtime && m_mtimeNsec == other.m_mtimeNsec;
+    }
+};
+
+static void read_exact(DS::Stream* stream, void* buffer, size_t size)
+{
+    if (stream->readBytes(buffer, size) != static_cast<ssize_t>(size))
+        throw DS::EofException();
+}
+
+static void write_default(DS::Stream* stream, const SDL::VarDescriptor& var)
+{
+    const SDL::VarDefault& def = var.m_default;
+    stream->write<bool>(def.m_valid);
+    if (!def.m_valid)
+        return;
+
+    switch (var.m_type) {
+    case SDL::e_VarBool:
+        stream->write<bool>(def.m_bool);
+        break;
+    case SDL::e_VarInt:
+    case SDL::e_VarByte:
+    case SDL::e_VarShort:
+        stream->write<int32_t>(def.m_int);
+        break;
+    case SDL::e_VarFloat:
+        stream->write<float>(def.m_float);
+        break;
+    case SDL::e_VarDouble:
+        stream->write<double>(def.m_double);
+        break;
+    case SDL::e_VarString:
+        stream->writeSafeString(def.m_string);
+        break;
+    case SDL::e_VarTime:
+        stream->write<uint32_t>(def.m_time.m_secs);
+        stream->write<uint32_t>(def.m_time.m_micros);
+        break;
+    case SDL::e_VarVector3:
+    case SDL::e_VarPoint3:
+        stream->writeBytes(&def.m_vector, sizeof(def.m_vector));
+        break;
+    case SDL::e_VarQuaternion:
+        stream->writeBytes(&def.m_quat, sizeof(def.m_quat));
+        break;
+    case SDL::e_VarRgb:
+    case SDL::e_VarRgba:
+        stream->writeBytes(&def.m_color, sizeof(def.m_color));
+        break;
+    case SDL::e_VarRgb8:
+    case SDL::e_VarRgba8:
+        stream->writeBytes(&def.m_color8, sizeof(def.m_color8));
+        break;
+    default:
+        // plKeys can only default to nil
+        break;
+    }
+}
+
+static void read_default(DS::Stream* stream, SDL::VarDescriptor& var)
+{
+    SDL::VarDefault& def = var.m_default;
+    def.m_valid = stream->read<bool>();
+    if (!def.m_valid)
+        return;
+
+    switch (var.m_type) {
+    case SDL::e_VarBool:
+        def.m_bool = stream->read<bool>();
+        break;
+    case SDL::e_VarInt:
+    case SDL::e_VarByte:
+    case SDL::e_VarShort:
+        def.m_int = stream->read<int32_t>();
+        break;
+    case SDL::e_VarFloat:
+        def.m_float = stream->read<float>();
+        break;
+    case SDL::e_VarDouble:
+        def.m_double = stream->read<double>();
+        break;
+    case SDL::e_VarString:
+        def.m_string = stream->readSafeString();
+        break;
+    case SDL::e_VarTime:
+        def.m_time.m_secs = stream->read<uint32_t>();
+        def.m_time.m_micros = stream->read<uint32_t>();
+        break;
+    case SDL::e_VarVector3:
+    case SDL::e_VarPoint3:
+        read_exact(stream, &def.m_vector, sizeof(def.m_vector));
+        break;
+    case SDL::e_VarQuaternion:
+        read_exact(stream, &def.m_quat, sizeof(def.m_quat));
+        break;
+    case SDL::e_VarRgb:
+    case SDL::e_VarRgba:
+        read_exact(stream, &def.m_color, sizeof(def.m_color));
+        break;
+    case SDL::e_VarRgb8:
+    case SDL::e_VarRgba8:
+        read_exact(stream, &def.m_color8, sizeof(def.m_color8));
+        break;
+    default:
+        break;
+    }
+}
+
+static void write_cache(const ST::string& cachefile, const char* sdlpath,
+                        const std::vector<SdlFileInfo>& files,
+                        const std::list<SDL::StateDescriptor>& descriptors)
+{
+    ST::string tempname = cachefile + ".tmp";
+    try {
+        DS::FileStream stream;
+        stream.open(tempname.c_str(), "wb");
+        stream.write<uint32_t>(CACHE_MAGIC);
+        stream.write<uint32_t>(CACHE_VERSION);
+        stream.writeSafeString(sdlpath);
+        stream.write<uint32_t>(files.size());
+        for (const SdlFileInfo& file : files) {
+            stream.writeSafeString(file.m_filename);
+            stream.write<uint64_t>(file.m_size);
+            stream.write<int64_t>(file.m_mtime);
+            stream.write<int64_t>(file.m_mtimeNsec);
+        }
+
+        stream.write<uint32_t>(descriptors.size());
+        for (const SDL::StateDescriptor& desc : descriptors) {
+            stream.writeSafeString(desc.m_name);
+            stream.write<int32_t>(desc.m_version);
+            stream.write<uint32_t>(desc.m_vars.size());
+            for (const SDL::VarDescriptor& var : desc.m_vars) {
+                stream.write<int32_t>(var.m_type);
+                stream.writeSafeString(var.m_typeName);
+                stream.writeSafeString(var.m_name);
+                stream.write<int32_t>(var.m_size);
+                stream.writeSafeString(var.m_defaultOption);
+                stream.writeSafeString(var.m_displayOption);
+                write_default(&stream, var);
             }
-#endif
-            s_descriptors[it->m_name][it->m_version] = *it;
+        }
+        stream.close();
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[SDL] Error writing descriptor cache {}: {}\n",
+                   cachefile, ex.what());
+        unlink(tempname.c_str());
+        return;
+    }
+
+    if (rename(tempname.c_str(), cachefile.c_str()) < 0) {
+        ST::printf(stderr, "[SDL] Error writing descriptor cache {}: {}\n",
+                   cachefile, strerror(errno));
+        unlink(tempname.c_str());
+    }
+}
+
+static bool read_cache(const ST::string& cachefile, const char* sdlpath,
+                       const std::vector<SdlFileInfo>& files,
+                       std::list<SDL::StateDescriptor>& descriptors)
+{
+    DS::FileStream file;
+    try {
+        file.open(cachefile.c_str(), "rb");
+    } catch (const DS::FileIOException&) {
+        return false;
+    }
 
-            // Keep the highest version in -1
-            if (s_descriptors[it->m_name][-1].m_version < it->m_version)
-                s_descriptors[it->m_name][-1] = *it;
+    try {
+        // Pull the whole thing in at once, rather than in stdio-sized chunks
+        uint32_t size = file.size();
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+        read_exact(&file, buffer.get(), size);
+        file.close();
+        DS::Blob blob = DS::Blob::Steal(buffer.release(), size);
+        DS::BlobStream stream(blob);
+
+        if (stream.read<uint32_t>() != CACHE_MAGIC
+                || stream.read<uint32_t>() != CACHE_VERSION
+                || stream.readSafeString() != sdlpath
+                || stream.read<uint32_t>() != files.size())
+            return false;
+        for (const SdlFileInfo& info : files) {
+            SdlFileInfo cached;
+            cached.m_filename = stream.readSafeString();
+            cached.m_size = stream.read<uint64_t>();
+            cached.m_mtime = stream.read<int64_t>();
+            cached.m_mtimeNsec = stream.read<int64_t>();
+            if (!(cached == info))
+                return false;
+        }
+
+        uint32_t count = stream.read<uint32_t>();
+        for (uint32_t i = 0; i < count; ++i) {
+            descriptors.emplace_back();
+            SDL::StateDescriptor& desc = descriptors.back();
+            desc.m_name = stream.readSafeString();
+            desc.m_version = stream.read<int32_t>();
+            uint32_t varCount = stream.read<uint32_t>();
+            for (uint32_t v = 0; v < varCount; ++v) {
+                desc.m_vars.emplace_back();
+                SDL::VarDescriptor& var = desc.m_vars.back();
+                int32_t type = stream.read<int32_t>();
+                if (type < SDL::e_VarInt || type > SDL::e_VarRgba8)
+                    throw DS::FileIOException("Bad variable type");
+                var.m_type = static_cast<SDL::VarType>(type);
+                var.m_typeName = stream.readSafeString();
+                var.m_name = stream.readSafeString();
+                var.m_size = stream.read<int32_t>();
+                var.m_defaultOption = stream.readSafeString();
+                var.m_displayOption = stream.readSafeString();
+                read_default(&stream, var);
+                desc.m_varmap[var.m_name] = v;
+            }
         }
+        if (!stream.atEof())
+            throw DS::FileIOException("Trailing data");
+    } catch (const std::exception& ex) {
+        ST::printf(stderr, "[SDL] Error reading descriptor cache {}: {}\n",
+                   cachefile, ex.what());
+        descriptors.clear();
+        return false;
     }
     return true;
 }
 
-bool SDL::DescriptorDb::LoadDescriptors(const char* sdlpath)
+/* Each file is parsed into its own list, so the results come out in the
+ * same order as they would from parsing the files one at a time. */
+/* Files which fail to parse are reported and skipped.  complete is
+ * cleared if that happened, since the result then shouldn't be cached. */
+static std::list<SDL::StateDescriptor> parse_files(const std::vector<ST::string>& paths,
+                                                   bool& complete)
 {
+    std::vector<std::list<SDL::StateDescriptor>> parsed(paths.size());
+    std::atomic<bool> failed(false);
+    auto parse = [&paths, &parsed, &failed](size_t index) {
+        try {
+            SDL::Parser parser;
+            if (parser.open(paths[index].c_str())) {
+                parsed[index] = parser.parse();
+                if (parser.failed())
+                    failed = true;
+            } else {
+                failed = true;
+            }
+        } catch (const std::exception& ex) {
+            ST::printf(stderr, "[SDL] Error parsing {}: {}\n", paths[index], ex.what());
+            failed = true;
+        }
+    };
+
+    size_t threads = std::min<size_t>(paths.size(), std::thread::hardware_concurrency());
+    if (threads > 1) {
+        DS::ThreadPool pool(threads);
+        std::mutex pendingMutex;
+        std::condition_variable pendingDone;
+        size_t pending = paths.size();
+        for (size_t i = 0; i < paths.size(); ++i) {
+            pool.submit([&parse, &pendingMutex, &pendingDone, &pending, i] {
+                parse(i);
+                std::lock_guard<std::mutex> lock(pendingMutex);
+                if (--pending == 0)
+                    pendingDone.notify_one();
+            });
+        }
+        std::unique_lock<std::mutex> lock(pendingMutex);
+        pendingDone.wait(lock, [&pending] { return pending == 0; });
+    } else {
+        for (size_t i = 0; i < paths.size(); ++i)
+            parse(i);
+    }
+
+    std::list<SDL::StateDescriptor> descriptors;
+    for (auto& fileDescriptors : parsed)
+        descriptors.splice(descriptors.end(), fileDescriptors);
+    complete = !failed;
+    return descriptors;
+}
+
+void SDL::DescriptorDb::AddDescriptor(descmap_t& descriptors, StateDescriptor&& desc)
+{
+    State::Compile(&desc);
+    auto idi = s_ids.find(desc.m_name);
+    if (idi == s_ids.end())
+        idi = s_ids.emplace(desc.m_name, s_ids.size() + 1).first;
+    desc.m_id = idi->second;
+
+    DescriptorVersions& versions = descriptors[desc.m_name];
+#ifdef DEBUG
+    if (versions.m_versions.find(desc.m_version) != versions.m_versions.end()) {
+        ST::printf(stderr, "[SDL] Warning: Duplicate descriptor version for {}\n",
+                   desc.m_name);
+    }
+#endif
+    StateDescriptor& stored = versions.m_versions[desc.m_version];
+    stored = std::move(desc);
+
+    // Map nodes never move, so this stays valid as more versions are added
+    if (!versions.m_latest || versions.m_latest->m_version < stored.m_version)
+        versions.m_latest = &stored;
+}
+
+bool SDL::DescriptorDb::LoadDescriptors(const char* sdlpath, const ST::string& cachefile)
+{
+    std::list<StateDescriptor> descriptors;
     try {
-        ForDescriptorFiles(sdlpath, LoadDescriptorsFromFile);
+        // Anything that can't be stat'ed will fail to parse as well, so
+        // there is no sense in caching the result
+        std::vector<ST::string> paths;
+        std::vector<SdlFileInfo> files;
+        bool useCache = !cachefile.empty();
+        ForDescriptorFiles(sdlpath, [&paths, &files, &useCache](const ST::string& path) {
+            paths.push_back(path);
+            if (!useCache)
+                return true;
+            struct stat sbuf;
+            if (stat(path.c_str(), &sbuf) < 0) {
+                useCache = false;
+                return true;
+            }
+            files.push_back({path.after_last('/'), static_cast<uint64_t>(sbuf.st_size),
+                             sbuf.st_mtim.tv_sec, sbuf.st_mtim.tv_nsec});
+            return true;
+        });
+
+        if (!useCache || !read_cache(cachefile, sdlpath, files, descriptors)) {
+            bool complete;
+            descriptors = parse_files(paths, complete);
+            if (!complete)
+                fputs("[SDL] Not caching descriptors, since some files failed to parse\n", stderr);
+            else if (useCache)
+                write_cache(cachefile, sdlpath, files, descriptors);
+        }
     } catch (const DS::SystemError& err) {
         fputs(err.what(), stderr);
         return false;
     }
+
+    std::lock_guard<std::mutex> lock(s_loadMutex);
+    std::unique_ptr<Snapshot> snapshot(new Snapshot);
+    for (StateDescriptor& desc : descriptors)
+        AddDescriptor(snapshot->m_descriptors, std::move(desc));
+
+    // The names are viewed in place, so this waits until nothing will move
+    for (auto& namei : snapshot->m_descriptors) {
+        for (auto& veri : namei.second.m_versions) {
+            const ST::string& name = veri.second.m_name;
+            snapshot->m_exact[{std::string_view(name.c_str(), name.size()), veri.first}] = &veri.second;
+            veri.second.m_users = &snapshot->m_users;
+            for (VarDescriptor& var : veri.second.m_vars)
+                var.m_users = &snapshot->m_users;
+        }
+        const ST::string& name = namei.second.m_latest->m_name;
+        snapshot->m_exact[{std::string_view(name.c_str(), name.size()), -1}] = namei.second.m_latest;
+    }
+
+    Snapshot* previous = s_current.load(std::memory_order_relaxed);
+    snapshot->m_generation = previous->m_generation + 1;
+    previous->m_retiredBy = snapshot->m_generation;
+    s_current.store(snapshot.get());
+
+    // A Lease taken from here on can only see the new generation.  One
+    // which read s_current earlier may not have counted itself yet, so
+    // nothing is freed until the next load if any are part way through.
+    if (s_leasing.load() == 0) {
+        for (auto geni = s_generations.begin(); geni != s_generations.end(); ) {
+            const Snapshot* old = geni->get();
+            if (old->m_retiredBy && old->m_users.load() == 0)
+                geni = s_generations.erase(geni);
+            else
+                ++geni;
+        }
+    }
+    s_generations.emplace_back(std::move(snapshot));
     return true;
 }
 
-SDL::StateDescriptor* SDL::DescriptorDb::FindDescriptor(const ST::string& name, int version)
+SDL::DescriptorDb::Lease::Lease()
+{
+    // Sequentially consistent, so that either LoadDescriptors sees
+    // s_leasing set, or we see the generation which replaced this one
+    s_leasing.fetch_add(1);
+    m_snapshot = s_current.load();
+    m_snapshot->m_users.fetch_add(1);
+    s_leasing.fetch_sub(1);
+}
+
+SDL::DescriptorDb::Lease::~Lease()
 {
-    descmap_t::iterator namei = s_descriptors.find(name);
-    if (namei == s_descriptors.end()) {
+    m_snapshot->m_users.fetch_sub(1, std::memory_order_release);
+}
+
+SDL::StateDescriptor* SDL::DescriptorDb::Lease::find(const ST::string& name,
+                                                     int version) const
+{
+    descmap_t::iterator namei = m_snapshot->m_descriptors.find(name);
+    if (namei == m_snapshot->m_descriptors.end()) {
         ST::printf(stderr, "[SDL] Requested invalid descriptor {}\n", name);
         return nullptr;
     }
 
-    versionmap_t::iterator veri = namei->second.find(version);
-    if (veri == namei->second.end()) {
+    if (version == -1)
+        return namei->second.m_latest;
+
+    versionmap_t::iterator veri = namei->second.m_versions.find(version);
+    if (veri == namei->second.m_versions.end()) {
         ST::printf(stderr, "[SDL] Requested invalid descriptor version {} for {}\n",
                    version, name);
         return nullptr;
@@ -84,39 +467,46 @@ SDL::StateDescriptor* SDL::DescriptorDb::FindDescriptor(const ST::string& name,
     return &veri->second;
 }
 
-SDL::StateDescriptor* SDL::DescriptorDb::FindLatestDescriptor(const ST::string& name)
+SDL::StateDescriptor* SDL::DescriptorDb::Lease::find(const char* name, size_t length,
+                                                     int version) const
 {
-    descmap_t::iterator namei = s_descriptors.find(name);
-    if (namei == s_descriptors.end()) {
+    auto exacti = m_snapshot->m_exact.find({std::string_view(name, length), version});
+    if (exacti != m_snapshot->m_exact.end())
+        return exacti->second;
+    return find(ST::string::from_latin_1(name, length), version);
+}
+
+SDL::StateDescriptor* SDL::DescriptorDb::Lease::findLatest(const ST::string& name) const
+{
+    descmap_t::iterator namei = m_snapshot->m_descriptors.find(name);
+    if (namei == m_snapshot->m_descriptors.end()) {
         ST::printf(stderr, "[SDL] Requested invalid descriptor {}\n", name);
         return nullptr;
     }
 
-    versionmap_t::iterator veri = namei->second.begin();
-    versionmap_t::iterator newi = veri;
-    for ( ; veri != namei->second.end(); ++veri) {
-        if (veri->first > newi->first)
-            newi = veri;
-    }
-
-    return &newi->second;
+    return namei->second.m_latest;
 }
 
-bool SDL::DescriptorDb::ForLatestDescriptors(descfunc_t functor)
+bool SDL::DescriptorDb::Lease::forLatest(descfunc_t functor) const
 {
-    for (auto namei = s_descriptors.begin(); namei != s_descriptors.end(); ++namei) {
-        auto veri = namei->second.begin();
-        auto newi = veri;
-        for ( ; veri != namei->second.end(); ++veri) {
-            if (veri->first > newi->first)
-                newi = veri;
-        }
-        if (!functor(namei->first, &newi->second))
+    for (auto namei = m_snapshot->m_descriptors.begin(); namei != m_snapshot->m_descriptors.end(); ++namei) {
+        if (!functor(namei->first, namei->second.m_latest))
             return false;
     }
     return true;
 }
 
+uint32_t SDL::DescriptorDb::Generation()
+{
+    return s_current.load(std::memory_order_acquire)->m_generation;
+}
+
+size_t SDL::DescriptorDb::RetainedGenerations()
+{
+    std::lock_guard<std::mutex> lock(s_loadMutex);
+    return s_generations.empty() ? 0 : s_generations.size() - 1;
+}
+
 bool SDL::DescriptorDb::ForDescriptorFiles(const char* sdlpath, filefunc_t functor)
 {
     dirent** dirls;
@@ -19,7 +19,11 @@
 #define _SDL_DESCRIPTORDB_H
 
 #include "StateInfo.h"
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
@@ -54,6 +58,26 @@ namespace SDL
         }
     };
 
+    enum VarCodecOp
+    {
+        e_CodecInvalid, e_CodecNone, e_CodecRaw, e_CodecBool, e_CodecString,
+        e_CodecKey, e_CodecCreatable, e_CodecTime, e_CodecRgb, e_CodecRgb8,
+        e_CodecRgba8, e_CodecState,
+    };
+
+    /* How a variable's values are stored and serialized.  Worked out once
+     * per descriptor by State::Compile, so parsing doesn't have to. */
+    struct VarCodec
+    {
+        VarCodecOp m_op;
+        uint32_t m_valueSize;       // In memory; also on the wire for e_CodecRaw
+        uint32_t m_valueOffset;     // Into the State's arena, or 0 if not stored there
+        bool m_hasDefault;          // Whether isDefault() can ever be true
+
+        VarCodec() : m_op(e_CodecInvalid), m_valueSize(), m_valueOffset(),
+                     m_hasDefault() { }
+    };
+
     struct VarDescriptor
     {
         VarType m_type;
@@ -62,8 +86,12 @@ namespace SDL
         int m_size;
         VarDefault m_default;
         ST::string m_defaultOption, m_displayOption;
+        VarCodec m_codec;
+
+        // Use count of the generation this belongs to, once published
+        std::atomic<size_t>* m_users;
 
-        VarDescriptor() : m_type(e_VarInvalid), m_size() { }
+        VarDescriptor() : m_type(e_VarInvalid), m_size(), m_users() { }
 
         void clear()
         {
@@ -74,6 +102,8 @@ namespace SDL
             m_default.clear();
             m_defaultOption.clear();
             m_displayOption.clear();
+            m_codec = VarCodec();
+            m_users = nullptr;
         }
     };
 
@@ -85,7 +115,31 @@ namespace SDL
         typedef std::unordered_map<ST::string, int, ST::hash> varmap_t;
         varmap_t m_varmap;
 
-        StateDescriptor() : m_version(-1) { }
+        // Set by State::Compile.  Fixed-size values which can be copied
+        // bytewise are laid out first in the arena, from m_podBegin to
+        // m_podEnd, and m_defaults holds that region for a default state.
+        size_t m_arenaSize, m_podBegin, m_podEnd;
+        std::vector<uint8_t> m_defaults;
+        bool m_compiled;
+
+        // Also set by State::Compile.  m_stateVarMask has a bit set for
+        // each statedesc variable, in the layout of State's dirty bitmap,
+        // and m_listIndex is each variable's index on the wire (within
+        // either the simple or the statedesc variables).
+        std::vector<uint64_t> m_stateVarMask;
+        std::vector<uint32_t> m_listIndex;
+
+        // Shared by every version of a descriptor, and kept across reloads
+        uint32_t m_id;
+
+        // Counts the States and variables using descriptors from the
+        // generation this belongs to.  Null until the generation is
+        // published, and for descriptors DescriptorDb doesn't own.
+        std::atomic<size_t>* m_users;
+
+        StateDescriptor()
+            : m_version(-1), m_arenaSize(), m_podBegin(), m_podEnd(),
+              m_compiled(), m_id(), m_users() { }
 
         void clear()
         {
@@ -93,31 +147,129 @@ namespace SDL
             m_version = -1;
             m_vars.clear();
             m_varmap.clear();
+            m_arenaSize = 0;
+            m_podBegin = 0;
+            m_podEnd = 0;
+            m_defaults.clear();
+            m_compiled = false;
+            m_stateVarMask.clear();
+            m_listIndex.clear();
+            m_id = 0;
+            m_users = nullptr;
         }
     };
 
+    /* Descriptors are published as immutable generations.  Loading a
+     * directory builds a new one and swaps it in, and lookups go through
+     * a Lease on the generation that was current when it was taken.
+     * States keep pointing into the generation they were created from
+     * until State::update() moves them to the latest descriptor.  A
+     * replaced generation is freed by a later load once no Lease, State or
+     * variable uses it. */
     class DescriptorDb
     {
+        struct Snapshot;
+
     public:
         typedef std::function<bool(const ST::string&, StateDescriptor*)> descfunc_t;
         typedef std::function<bool(ST::string path)> filefunc_t;
 
-        static bool LoadDescriptors(const char* sdlpath);
-        static StateDescriptor* FindDescriptor(const ST::string& name, int version);
-        static StateDescriptor* FindLatestDescriptor(const ST::string& name);
-        static bool ForLatestDescriptors(descfunc_t functor);
+        /* Keeps the current generation alive while descriptors are looked
+         * up in it.  Anything found stays valid for the life of the Lease,
+         * so a State made from it before then keeps it valid after. */
+        class Lease
+        {
+        public:
+            Lease();
+            ~Lease();
+
+            StateDescriptor* find(const ST::string& name, int version) const;
+
+            /* For names read straight off the wire.  Exact matches are
+             * found without any case folding or string conversion;
+             * anything else goes through the lookup above. */
+            StateDescriptor* find(const char* name, size_t length, int version) const;
+            StateDescriptor* findLatest(const ST::string& name) const;
+            bool forLatest(descfunc_t functor) const;
+
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+
+        private:
+            Snapshot* m_snapshot;
+        };
+
+        /* If cachefile is set, descriptors are loaded from it instead of
+         * being parsed, as long as none of the .sdl files have changed
+         * since it was written.  Otherwise, it is rewritten. */
+        static bool LoadDescriptors(const char* sdlpath,
+                                    const ST::string& cachefile = ST::string());
         static bool ForDescriptorFiles(const char* sdlpath, filefunc_t functor);
 
+        // Number of times descriptors have been loaded
+        static uint32_t Generation();
+
+        // Replaced generations which haven't been freed yet
+        static size_t RetainedGenerations();
+
     private:
         DescriptorDb() = delete;
         DescriptorDb(const DescriptorDb&) = delete;
         ~DescriptorDb() = delete;
 
-        static bool LoadDescriptorsFromFile(const ST::string& path);
-
         typedef std::unordered_map<int, StateDescriptor> versionmap_t;
-        typedef std::unordered_map<ST::string, versionmap_t, ST::hash_i, ST::equal_i> descmap_t;
-        static descmap_t s_descriptors;
+        struct DescriptorVersions
+        {
+            versionmap_t m_versions;
+            StateDescriptor* m_latest;      // Points into m_versions
+
+            DescriptorVersions() : m_latest() { }
+        };
+        typedef std::unordered_map<ST::string, DescriptorVersions, ST::hash_i, ST::equal_i> descmap_t;
+
+        struct ExactKey
+        {
+            std::string_view m_name;
+            int m_version;
+
+            bool operator==(const ExactKey& other) const
+            {
+                return m_version == other.m_version && m_name == other.m_name;
+            }
+        };
+
+        struct ExactKeyHash
+        {
+            size_t operator()(const ExactKey& key) const
+            {
+                return std::hash<std::string_view>()(key.m_name) ^ (key.m_version * 0x9E3779B9U);
+            }
+        };
+
+        struct Snapshot
+        {
+            descmap_t m_descriptors;
+            std::unordered_map<ExactKey, StateDescriptor*, ExactKeyHash> m_exact;
+            uint32_t m_generation;
+
+            // m_retiredBy is the generation which replaced this one
+            std::atomic<size_t> m_users;
+            uint32_t m_retiredBy;
+
+            Snapshot() : m_generation(), m_users(), m_retiredBy() { }
+        };
+
+        static void AddDescriptor(descmap_t& descriptors, StateDescriptor&& desc);
+
+        static Snapshot s_empty;
+        static std::atomic<Snapshot*> s_current;
+
+        // Leases which are still counting themselves as users of s_current
+        static std::atomic<size_t> s_leasing;
+
+        static std::mutex s_loadMutex;
+        static std::vector<std::unique_ptr<Snapshot>> s_generations;
+        static std::unordered_map<ST::string, uint32_t, ST::hash_i, ST::equal_i> s_ids;
     };
 }
 
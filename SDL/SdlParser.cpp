@@ -505,13 +505,18 @@ std::list<SDL::StateDescriptor> SDL::Parser::parse()
     StateDescriptor descBuffer;
     VarDescriptor varBuffer;
     int state = e_State_File;
+    m_failed = false;
     for ( ;; ) {
         SDL::Token tok = next();
-        if (tok.m_type == e_TokError)
+        if (tok.m_type == e_TokError) {
+            m_failed = true;
             break;
+        }
         if (tok.m_type == e_TokEof) {
-            if (state != e_State_File)
+            if (state != e_State_File) {
                 ST::printf(stderr, "[SDL] Unexpected EOF in {}\n", m_filename);
+                m_failed = true;
+            }
             break;
         }
 
@@ -56,7 +56,7 @@ namespace SDL
     class Parser
     {
     public:
-        Parser() : m_fileStream(), m_encStream(), m_lineno(-1) { }
+        Parser() : m_fileStream(), m_encStream(), m_lineno(-1), m_failed() { }
         ~Parser() { close(); }
 
         bool open(const char* filename);
@@ -67,7 +67,10 @@ namespace SDL
         Token next();
         void push(Token tok) { m_buffer.push_front(tok); }
 
+        /* Stops at the first error, returning what was parsed before it.
+         * failed() tells whether that happened. */
         std::list<StateDescriptor> parse();
+        bool failed() const { return m_failed; }
 
     private:
         DS::FileStream* m_fileStream;
@@ -75,6 +78,7 @@ namespace SDL
         ST::string m_filename;
         long m_lineno;
         std::list<Token> m_buffer;
+        bool m_failed;
 
         DS::Stream* stream() const;
     };
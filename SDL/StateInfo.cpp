@@ -20,6 +20,10 @@
 #include "PlasMOUL/factory.h"
 #include "Types/BitVector.h"
 #include "errors.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
 
 static size_t stupidLengthRead(DS::Stream* stream, size_t max)
 {
@@ -40,267 +44,392 @@ static void stupidLengthWrite(DS::Stream* stream, size_t max, size_t value)
         stream->write<uint32_t>(value);
 }
 
-SDL::Variable::_ref::_ref(SDL::VarDescriptor* desc)
-    : m_size(0), m_flags(0), m_refs(1), m_desc(desc)
+/* Calls func with a null pointer of the C++ type used to store values of
+ * the given SDL type.  Types without stored values are skipped. */
+template <typename Func>
+static void with_value_type(SDL::VarType type, Func func)
 {
-    if (m_desc->m_size > 0)
-        resize(m_desc->m_size);
-}
-
-void SDL::Variable::_ref::resize(size_t size)
-{
-    clear();
-    m_size = size;
-    if (m_size == 0)
-        return;
-
-    switch (m_desc->m_type) {
-    case e_VarInt:
-        m_int = new int32_t[m_size];
-        memset(m_int, 0, m_size * sizeof(int32_t));
+    switch (type) {
+    case SDL::e_VarInt:
+        func(static_cast<int32_t*>(nullptr));
         break;
-    case e_VarFloat:
-        m_float = new float[m_size];
-        memset(m_float, 0, m_size * sizeof(float));
+    case SDL::e_VarFloat:
+        func(static_cast<float*>(nullptr));
         break;
-    case e_VarBool:
-        m_bool = new bool[m_size];
-        memset(m_bool, 0, m_size * sizeof(bool));
+    case SDL::e_VarBool:
+        func(static_cast<bool*>(nullptr));
         break;
-    case e_VarString:
-        m_string = new ST::string[m_size];
+    case SDL::e_VarString:
+        func(static_cast<ST::string*>(nullptr));
         break;
-    case e_VarKey:
-        m_key = new MOUL::Uoid[m_size];
+    case SDL::e_VarKey:
+        func(static_cast<MOUL::Uoid*>(nullptr));
         break;
-    case e_VarCreatable:
-        m_creatable = new MOUL::Creatable*[m_size];
-        memset(m_creatable, 0, m_size * sizeof(MOUL::Creatable*));
+    case SDL::e_VarCreatable:
+        func(static_cast<MOUL::Creatable**>(nullptr));
         break;
-    case e_VarDouble:
-        m_double = new double[m_size];
-        memset(m_double, 0, m_size * sizeof(double));
+    case SDL::e_VarDouble:
+        func(static_cast<double*>(nullptr));
         break;
-    case e_VarTime:
-        m_time = new DS::UnifiedTime[m_size];
+    case SDL::e_VarTime:
+        func(static_cast<DS::UnifiedTime*>(nullptr));
         break;
-    case e_VarByte:
-        m_byte = new int8_t[m_size];
-        memset(m_byte, 0, m_size * sizeof(int8_t));
+    case SDL::e_VarByte:
+        func(static_cast<int8_t*>(nullptr));
         break;
-    case e_VarShort:
-        m_short = new int16_t[m_size];
-        memset(m_short, 0, m_size * sizeof(int16_t));
+    case SDL::e_VarShort:
+        func(static_cast<int16_t*>(nullptr));
         break;
-    case e_VarVector3:
-    case e_VarPoint3:
-        m_vector = new DS::Vector3[m_size];
+    case SDL::e_VarVector3:
+    case SDL::e_VarPoint3:
+        func(static_cast<DS::Vector3*>(nullptr));
         break;
-    case e_VarQuaternion:
-        m_quat = new DS::Quaternion[m_size];
+    case SDL::e_VarQuaternion:
+        func(static_cast<DS::Quaternion*>(nullptr));
         break;
-    case e_VarRgb:
-    case e_VarRgba:
-        m_color = new DS::ColorRgba[m_size];
+    case SDL::e_VarRgb:
+    case SDL::e_VarRgba:
+        func(static_cast<DS::ColorRgba*>(nullptr));
         break;
-    case e_VarRgb8:
-    case e_VarRgba8:
-        m_color8 = new DS::ColorRgba8[m_size];
+    case SDL::e_VarRgb8:
+    case SDL::e_VarRgba8:
+        func(static_cast<DS::ColorRgba8*>(nullptr));
         break;
-    case e_VarStateDesc:
-        m_child = new SDL::State[m_size];
-        for (size_t i=0; i<m_size; ++i)
-            m_child[i] = SDL::State(DescriptorDb::FindDescriptor(m_desc->m_typeName, -1));
+    case SDL::e_VarStateDesc:
+        func(static_cast<SDL::State*>(nullptr));
         break;
     default:
         break;
     }
 }
 
-void SDL::Variable::_ref::clear()
+static size_t align_up(size_t offset, size_t align)
+{
+    return (offset + align - 1) & ~(align - 1);
+}
+
+/* Descriptor generations are only freed once nothing counts as using
+ * them.  Releases must come after the last access to the descriptor. */
+static void use_generation(std::atomic<size_t>* users)
+{
+    if (users)
+        users->fetch_add(1, std::memory_order_relaxed);
+}
+
+static void release_generation(std::atomic<size_t>* users)
+{
+    if (users)
+        users->fetch_sub(1, std::memory_order_release);
+}
+
+/* One allocation holding every variable of a State: the header, then the
+ * Variable::_ref for each of the descriptor's variables, then the value
+ * arrays of the fixed-size ones.  Variable-length arrays are allocated
+ * separately when they are resized.  Each Variable handle referring into
+ * the arena holds a reference to the whole arena. */
+struct SDL::VarArena
+{
+    std::atomic_int m_refs;
+    size_t m_count;
+    std::atomic<size_t>* m_users;
+
+    Variable::_ref* vars()
+    {
+        return reinterpret_cast<Variable::_ref*>(reinterpret_cast<uint8_t*>(this)
+                                                 + header_size());
+    }
+
+    static constexpr size_t header_size()
+    {
+        return (sizeof(VarArena) + alignof(Variable::_ref) - 1)
+               & ~(alignof(Variable::_ref) - 1);
+    }
+
+    static VarArena* Create(StateDescriptor* desc)
+    {
+        DS_ASSERT(desc->m_compiled);
+        uint8_t* buffer = static_cast<uint8_t*>(::operator new(desc->m_arenaSize));
+        VarArena* arena = new (buffer) VarArena;
+        arena->m_refs = desc->m_vars.size();
+        arena->m_count = desc->m_vars.size();
+        arena->m_users = desc->m_users;
+        use_generation(arena->m_users);
+
+        for (size_t i = 0; i < arena->m_count; ++i) {
+            VarDescriptor* var = &desc->m_vars[i];
+            uint32_t offset = var->m_codec.m_valueOffset;
+            new (&arena->vars()[i]) Variable::_ref(var, arena, offset ? buffer + offset : nullptr);
+        }
+        return arena;
+    }
+
+    void ref() { ++m_refs; }
+    void unref(int count = 1)
+    {
+        if ((m_refs -= count) != 0)
+            return;
+        for (size_t i = 0; i < m_count; ++i)
+            vars()[i].~_ref();
+        std::atomic<size_t>* users = m_users;
+        this->~VarArena();
+        ::operator delete(this);
+        release_generation(users);
+    }
+};
+
+SDL::Variable::_ref::_ref(SDL::VarDescriptor* desc, SDL::VarArena* arena,
+                          void* inlineValues)
+    : m_values(), m_size(0), m_flags(0), m_refs(1), m_desc(desc),
+      m_arena(arena), m_inline(inlineValues)
+{
+    // Variables in an arena are counted by the arena
+    if (!m_arena)
+        use_generation(m_desc->m_users);
+    if (m_desc->m_size > 0)
+        resize(m_desc->m_size);
+}
+
+SDL::Variable::_ref::~_ref()
+{
+    clear();
+    if (!m_arena)
+        release_generation(m_desc->m_users);
+}
+
+void SDL::Variable::_ref::ref()
+{
+    if (m_arena)
+        m_arena->ref();
+    else
+        ++m_refs;
+}
+
+void SDL::Variable::_ref::unref()
+{
+    if (m_arena)
+        m_arena->unref();
+    else if (--m_refs == 0)
+        delete this;
+}
+
+void SDL::Variable::_ref::resize(size_t size)
 {
-    m_flags &= ~e_XIsDirty;
+    clear();
+    m_size = size;
     if (m_size == 0)
         return;
 
-    switch (m_desc->m_type) {
-    case e_VarInt:
-        delete[] m_int;
-        break;
-    case e_VarFloat:
-        delete[] m_float;
-        break;
-    case e_VarBool:
-        delete[] m_bool;
-        break;
-    case e_VarString:
-        delete[] m_string;
-        break;
-    case e_VarKey:
-        delete[] m_key;
-        break;
-    case e_VarCreatable:
-        for (int i=0; i<m_desc->m_size; ++i)
+    with_value_type(m_desc->m_type, [this](auto* tag) {
+        typedef typename std::remove_pointer<decltype(tag)>::type value_t;
+        if (m_inline && m_size == static_cast<size_t>(m_desc->m_size))
+            m_values = m_inline;
+        else
+            m_values = ::operator new(m_size * sizeof(value_t));
+        std::uninitialized_value_construct_n(static_cast<value_t*>(m_values), m_size);
+    });
+
+    if (m_desc->m_type == e_VarStateDesc) {
+        DescriptorDb::Lease descriptors;
+        for (size_t i=0; i<m_size; ++i)
+            m_child[i] = SDL::State(descriptors.find(m_desc->m_typeName, -1));
+    }
+}
+
+void SDL::Variable::_ref::clear()
+{
+    if (m_size == 0 || !m_values)
+        return;
+
+    if (m_desc->m_type == e_VarCreatable) {
+        for (size_t i=0; i<m_size; ++i)
             MOUL::Creatable::SafeUnref(m_creatable[i]);
-        delete[] m_creatable;
-        break;
-    case e_VarDouble:
-        delete[] m_double;
-        break;
-    case e_VarTime:
-        delete[] m_time;
-        break;
-    case e_VarByte:
-        delete[] m_byte;
-        break;
-    case e_VarShort:
-        delete[] m_short;
-        break;
-    case e_VarVector3:
-    case e_VarPoint3:
-        delete[] m_vector;
-        break;
-    case e_VarQuaternion:
-        delete[] m_quat;
-        break;
-    case e_VarRgb:
-    case e_VarRgba:
-        delete[] m_color;
-        break;
-    case e_VarRgb8:
-    case e_VarRgba8:
-        delete[] m_color8;
-        break;
-    case e_VarStateDesc:
-        delete[] m_child;
-        break;
+    }
+    with_value_type(m_desc->m_type, [this](auto* tag) {
+        typedef typename std::remove_pointer<decltype(tag)>::type value_t;
+        std::destroy_n(static_cast<value_t*>(m_values), m_size);
+    });
+    if (m_values != m_inline)
+        ::operator delete(m_values);
+    m_values = nullptr;
+    m_size = 0;
+}
+
+static SDL::VarCodecOp codec_op(SDL::VarType type)
+{
+    // Values which are stored exactly as they appear on the wire
+    static_assert(sizeof(DS::Vector3) == 3 * sizeof(float), "Vector3 is padded");
+    static_assert(sizeof(DS::Quaternion) == 4 * sizeof(float), "Quaternion is padded");
+    static_assert(sizeof(DS::ColorRgba) == 4 * sizeof(float), "ColorRgba is padded");
+
+    switch (type) {
+    case SDL::e_VarInt:
+    case SDL::e_VarFloat:
+    case SDL::e_VarDouble:
+    case SDL::e_VarByte:
+    case SDL::e_VarShort:
+    case SDL::e_VarVector3:
+    case SDL::e_VarPoint3:
+    case SDL::e_VarQuaternion:
+    case SDL::e_VarRgba:
+        return SDL::e_CodecRaw;
+    case SDL::e_VarBool:
+        return SDL::e_CodecBool;
+    case SDL::e_VarString:
+        return SDL::e_CodecString;
+    case SDL::e_VarKey:
+        return SDL::e_CodecKey;
+    case SDL::e_VarCreatable:
+        return SDL::e_CodecCreatable;
+    case SDL::e_VarTime:
+        return SDL::e_CodecTime;
+    case SDL::e_VarRgb:
+        return SDL::e_CodecRgb;
+    case SDL::e_VarRgb8:
+        return SDL::e_CodecRgb8;
+    case SDL::e_VarRgba8:
+        return SDL::e_CodecRgba8;
+    case SDL::e_VarStateDesc:
+        return SDL::e_CodecState;
+    case SDL::e_VarAgeTimeOfDay:
+        return SDL::e_CodecNone;
     default:
-        break;
+        return SDL::e_CodecInvalid;
     }
 }
 
+static bool is_pod_codec(SDL::VarCodecOp op)
+{
+    return op == SDL::e_CodecRaw || op == SDL::e_CodecBool;
+}
+
 void SDL::Variable::_ref::read(DS::Stream* stream)
 {
-    for (size_t i=0; i<m_size; ++i) {
-        switch (m_desc->m_type) {
-        case e_VarInt:
-            m_int[i] = stream->read<int32_t>();
-            break;
-        case e_VarFloat:
-            m_float[i] = stream->read<float>();
-            break;
-        case e_VarBool:
-            m_bool[i] = stream->read<bool>();
-            break;
-        case e_VarString:
-            {
-                char buffer[33];
-                stream->readBytes(buffer, 32);
-                buffer[32] = 0;
-                m_string[i] = buffer;
+    if (m_size == 0)
+        return;
+
+    switch (m_desc->m_codec.m_op) {
+    case e_CodecRaw:
+        {
+            ssize_t bytes = m_size * m_desc->m_codec.m_valueSize;
+            if (stream->readBytes(m_values, bytes) != bytes)
+                throw DS::EofException();
+        }
+        break;
+    case e_CodecBool:
+        {
+            uint8_t buffer[256];
+            for (size_t i = 0; i < m_size; i += sizeof(buffer)) {
+                ssize_t count = std::min(m_size - i, sizeof(buffer));
+                if (stream->readBytes(buffer, count) != count)
+                    throw DS::EofException();
+                for (ssize_t j = 0; j < count; ++j)
+                    m_bool[i + j] = buffer[j] != 0;
             }
-            break;
-        case e_VarKey:
+        }
+        break;
+    case e_CodecString:
+        for (size_t i=0; i<m_size; ++i) {
+            char buffer[33];
+            stream->readBytes(buffer, 32);
+            buffer[32] = 0;
+            m_string[i] = buffer;
+        }
+        break;
+    case e_CodecKey:
+        for (size_t i=0; i<m_size; ++i)
             m_key[i].read(stream);
-            break;
-        case e_VarCreatable:
-            {
-                uint16_t type = stream->read<uint16_t>();
-                if (type != 0x8000) {
-                    m_creatable[i] = MOUL::Factory::Create(type);
-                    DS_ASSERT(m_creatable[i]);
-                    const uint32_t endp = stream->tell() + stream->read<uint32_t>();
-                    m_creatable[i]->read(stream);
-                    if (stream->tell() != endp) {
-                        ST::printf(stderr, "[SDL] Warning: Creatable {04X} was not fully parsed in SDL blob "
-                                           " ({} bytes remain)\n",
-                                   type, endp - stream->tell());
-                    }
+        break;
+    case e_CodecCreatable:
+        for (size_t i=0; i<m_size; ++i) {
+            uint16_t type = stream->read<uint16_t>();
+            if (type != 0x8000) {
+                m_creatable[i] = MOUL::Factory::Create(type);
+                DS_ASSERT(m_creatable[i]);
+                const uint32_t endp = stream->tell() + stream->read<uint32_t>();
+                m_creatable[i]->read(stream);
+                if (stream->tell() != endp) {
+                    ST::printf(stderr, "[SDL] Warning: Creatable {04X} was not fully parsed in SDL blob "
+                                       " ({} bytes remain)\n",
+                               type, endp - stream->tell());
                 }
             }
-            break;
-        case e_VarDouble:
-            m_double[i] = stream->read<double>();
-            break;
-        case e_VarTime:
+        }
+        break;
+    case e_CodecTime:
+        for (size_t i=0; i<m_size; ++i)
             m_time[i].read(stream);
-            break;
-        case e_VarByte:
-            m_byte[i] = stream->read<uint8_t>();
-            break;
-        case e_VarShort:
-            m_short[i] = stream->read<uint16_t>();
-            break;
-        case e_VarVector3:
-        case e_VarPoint3:
-            m_vector[i] = stream->read<DS::Vector3>();
-            break;
-        case e_VarQuaternion:
-            m_quat[i] = stream->read<DS::Quaternion>();
-            break;
-        case e_VarRgb:
-            m_color[i].m_R = stream->read<float>();
-            m_color[i].m_G = stream->read<float>();
-            m_color[i].m_B = stream->read<float>();
-            break;
-        case e_VarRgba:
+        break;
+    case e_CodecRgb:
+        for (size_t i=0; i<m_size; ++i) {
             m_color[i].m_R = stream->read<float>();
             m_color[i].m_G = stream->read<float>();
             m_color[i].m_B = stream->read<float>();
-            m_color[i].m_A = stream->read<float>();
-            break;
-        case e_VarRgb8:
+        }
+        break;
+    case e_CodecRgb8:
+        for (size_t i=0; i<m_size; ++i) {
             m_color8[i].m_R = stream->read<uint8_t>();
             m_color8[i].m_G = stream->read<uint8_t>();
             m_color8[i].m_B = stream->read<uint8_t>();
-            break;
-        case e_VarRgba8:
+        }
+        break;
+    case e_CodecRgba8:
+        for (size_t i=0; i<m_size; ++i) {
             m_color8[i].m_R = stream->read<uint8_t>();
             m_color8[i].m_G = stream->read<uint8_t>();
             m_color8[i].m_B = stream->read<uint8_t>();
             m_color8[i].m_A = stream->read<uint8_t>();
-            break;
-        case e_VarStateDesc:
-            // This should be handled elsewhere
-            DS_ASSERT(false);
-            break;
-        case e_VarAgeTimeOfDay:
-            // No data to read
-            break;
-        default:
-            ST::printf(stderr, "Invalid SDL variable type {} during read\n",
-                       static_cast<int>(m_desc->m_type));
-            throw DS::MalformedData();
         }
+        break;
+    case e_CodecState:
+        // This should be handled elsewhere
+        DS_ASSERT(false);
+        break;
+    case e_CodecNone:
+        // No data to read
+        break;
+    default:
+        ST::printf(stderr, "Invalid SDL variable type {} during read\n",
+                   static_cast<int>(m_desc->m_type));
+        throw DS::MalformedData();
     }
 }
 
 void SDL::Variable::_ref::write(DS::Stream* stream) const
 {
-    for (size_t i=0; i<m_size; ++i) {
-        switch (m_desc->m_type) {
-        case e_VarInt:
-            stream->write<int32_t>(m_int[i]);
-            break;
-        case e_VarFloat:
-            stream->write<float>(m_float[i]);
-            break;
-        case e_VarBool:
-            stream->write<bool>(m_bool[i]);
-            break;
-        case e_VarString:
-            {
-                char buffer[32];
-                memset(buffer, 0, 32);
-                strncpy(buffer, m_string[i].c_str(), 32);
-                buffer[31] = 0;
-                stream->writeBytes(buffer, 32);
+    if (m_size == 0)
+        return;
+
+    switch (m_desc->m_codec.m_op) {
+    case e_CodecRaw:
+        stream->writeBytes(m_values, m_size * m_desc->m_codec.m_valueSize);
+        break;
+    case e_CodecBool:
+        {
+            uint8_t buffer[256];
+            for (size_t i = 0; i < m_size; i += sizeof(buffer)) {
+                size_t count = std::min(m_size - i, sizeof(buffer));
+                for (size_t j = 0; j < count; ++j)
+                    buffer[j] = m_bool[i + j] ? 1 : 0;
+                stream->writeBytes(buffer, count);
             }
-            break;
-        case e_VarKey:
+        }
+        break;
+    case e_CodecString:
+        for (size_t i=0; i<m_size; ++i) {
+            char buffer[32];
+            memset(buffer, 0, 32);
+            strncpy(buffer, m_string[i].c_str(), 32);
+            buffer[31] = 0;
+            stream->writeBytes(buffer, 32);
+        }
+        break;
+    case e_CodecKey:
+        for (size_t i=0; i<m_size; ++i)
             m_key[i].write(stream);
-            break;
-        case e_VarCreatable:
+        break;
+    case e_CodecCreatable:
+        for (size_t i=0; i<m_size; ++i) {
             if (!m_creatable[i]) {
                 stream->write<uint16_t>(0x8000);
             } else {
@@ -313,60 +442,45 @@ void SDL::Variable::_ref::write(DS::Stream* stream) const
                 stream->write<uint32_t>(endpos - sizepos - sizeof(uint32_t));
                 stream->seek(endpos, SEEK_SET);
             }
-            break;
-        case e_VarDouble:
-            stream->write<double>(m_double[i]);
-            break;
-        case e_VarTime:
+        }
+        break;
+    case e_CodecTime:
+        for (size_t i=0; i<m_size; ++i)
             m_time[i].write(stream);
-            break;
-        case e_VarByte:
-            stream->write<uint8_t>(m_byte[i]);
-            break;
-        case e_VarShort:
-            stream->write<uint16_t>(m_short[i]);
-            break;
-        case e_VarVector3:
-        case e_VarPoint3:
-            stream->write<DS::Vector3>(m_vector[i]);
-            break;
-        case e_VarQuaternion:
-            stream->write<DS::Quaternion>(m_quat[i]);
-            break;
-        case e_VarRgb:
-            stream->write<float>(m_color[i].m_R);
-            stream->write<float>(m_color[i].m_G);
-            stream->write<float>(m_color[i].m_B);
-            break;
-        case e_VarRgba:
+        break;
+    case e_CodecRgb:
+        for (size_t i=0; i<m_size; ++i) {
             stream->write<float>(m_color[i].m_R);
             stream->write<float>(m_color[i].m_G);
             stream->write<float>(m_color[i].m_B);
-            stream->write<float>(m_color[i].m_A);
-            break;
-        case e_VarRgb8:
+        }
+        break;
+    case e_CodecRgb8:
+        for (size_t i=0; i<m_size; ++i) {
             stream->write<uint8_t>(m_color8[i].m_R);
             stream->write<uint8_t>(m_color8[i].m_G);
             stream->write<uint8_t>(m_color8[i].m_B);
-            break;
-        case e_VarRgba8:
+        }
+        break;
+    case e_CodecRgba8:
+        for (size_t i=0; i<m_size; ++i) {
             stream->write<uint8_t>(m_color8[i].m_R);
             stream->write<uint8_t>(m_color8[i].m_G);
             stream->write<uint8_t>(m_color8[i].m_B);
             stream->write<uint8_t>(m_color8[i].m_A);
-            break;
-        case e_VarStateDesc:
-            // This should be handled elsewhere
-            DS_ASSERT(false);
-            break;
-        case e_VarAgeTimeOfDay:
-            // No data to write
-            break;
-        default:
-            ST::printf(stderr, "Invalid SDL variable type {} during write\n",
-                       static_cast<int>(m_desc->m_type));
-            throw DS::MalformedData();
         }
+        break;
+    case e_CodecState:
+        // This should be handled elsewhere
+        DS_ASSERT(false);
+        break;
+    case e_CodecNone:
+        // No data to write
+        break;
+    default:
+        ST::printf(stderr, "Invalid SDL variable type {} during write\n",
+                   static_cast<int>(m_desc->m_type));
+        throw DS::MalformedData();
     }
 }
 
@@ -414,7 +528,6 @@ void SDL::Variable::read(DS::Stream* stream)
             m_data->read(stream);
         }
     }
-    m_data->m_flags |= e_XIsDirty;
 }
 
 void SDL::Variable::write(DS::Stream* stream) const
@@ -428,9 +541,12 @@ void SDL::Variable::write(DS::Stream* stream) const
         stream->writeSafeString(m_data->m_notificationHint);
     }
 
+    // The variable may be shared with other states and threads, so the
+    // default check only affects what is written
+    uint8_t flags = m_data->m_flags & 0xFF;
     if (isDefault())
-        m_data->m_flags |= e_SameAsDefault;
-    stream->write<uint8_t>(m_data->m_flags & 0xFF);
+        flags |= e_SameAsDefault;
+    stream->write<uint8_t>(flags);
     if (m_data->m_desc->m_type == e_VarStateDesc) {
         if (m_data->m_desc->m_size == -1)
             stream->write<uint32_t>(m_data->m_size);
@@ -439,7 +555,8 @@ void SDL::Variable::write(DS::Stream* stream) const
         size_t count = 0;
         for (size_t i=0; i<m_data->m_size; ++i) {
             dirty.set(i, m_data->m_child[i].isDirty());
-            ++count;
+            if (dirty.get(i))
+                ++count;
         }
         size_t stupid = m_data->m_desc->m_size == -1 ? 0 : m_data->m_size;
         stupidLengthWrite(stream, stupid, count);
@@ -452,10 +569,10 @@ void SDL::Variable::write(DS::Stream* stream) const
             }
         }
     } else {
-        if (m_data->m_flags & e_HasTimeStamp)
+        if (flags & e_HasTimeStamp)
             m_data->m_timestamp.write(stream);
 
-        if (!(m_data->m_flags & e_SameAsDefault)) {
+        if (!(flags & e_SameAsDefault)) {
             if (m_data->m_desc->m_size == -1)
                 stream->write<uint32_t>(m_data->m_size);
             m_data->write(stream);
@@ -745,12 +862,9 @@ bool SDL::Variable::isDefault() const
 
     // Variable length vars are never at the default!
     // Why? The count is read/written in a !default block.
-    if (m_data->m_desc->m_size == -1)
-        return false;
-
-    // Don't assume any one default is the same thing that the client
+    // Also, don't assume any one default is the same thing that the client
     // will provide if the default is missing from the SDL file
-    if (!m_data->m_desc->m_default.m_valid)
+    if (!m_data->m_desc->m_codec.m_hasDefault)
         return false;
 
     for (size_t i=0; i<m_data->m_size; ++i) {
@@ -855,26 +969,201 @@ SDL::State::State(SDL::StateDescriptor* desc)
     if (desc) {
         m_data = new _ref(desc);
         m_data->m_vars.resize(desc->m_vars.size());
-        m_data->m_simpleVars.reserve(desc->m_vars.size());
-        m_data->m_sdVars.reserve(desc->m_vars.size());
+        VarArena* arena = desc->m_vars.empty() ? nullptr : VarArena::Create(desc);
+        m_data->m_arena = arena;
+        m_data->m_dirty.assign((desc->m_vars.size() + 63) / 64, 0);
         for (size_t i=0; i<desc->m_vars.size(); ++i) {
-            m_data->m_vars[i] = SDL::Variable(&m_data->m_desc->m_vars[i]);
-            if (desc->m_vars[i].m_type == e_VarStateDesc)
-                m_data->m_sdVars.push_back(&m_data->m_vars[i]);
-            else
-                m_data->m_simpleVars.push_back(&m_data->m_vars[i]);
+            // The arena starts out with a reference for each of these
+            m_data->m_vars[i].m_data = &arena->vars()[i];
+        }
+        m_data->linkVars();
+
+        if (!desc->m_defaults.empty()) {
+            uint8_t* base = reinterpret_cast<uint8_t*>(arena);
+            memcpy(base + desc->m_podBegin, desc->m_defaults.data(), desc->m_defaults.size());
+            for (Variable& var : m_data->m_vars) {
+                if (is_pod_codec(var.descriptor()->m_codec.m_op) && var.descriptor()->m_size > 0)
+                    var.m_data->m_flags |= Variable::e_SameAsDefault;
+                else
+                    var.setDefault();
+            }
+        } else {
+            setDefault();
         }
-        setDefault();
     }
 }
 
+void SDL::State::Compile(SDL::StateDescriptor* desc)
+{
+    desc->m_compiled = false;
+    desc->m_defaults.clear();
+
+    size_t size = VarArena::header_size() + desc->m_vars.size() * sizeof(Variable::_ref);
+    size = align_up(size, alignof(std::max_align_t));
+    desc->m_podBegin = size;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (VarDescriptor& var : desc->m_vars) {
+            VarCodecOp op = codec_op(var.m_type);
+            if (is_pod_codec(op) != (pass == 0))
+                continue;
+
+            VarCodec& codec = var.m_codec;
+            codec = VarCodec();
+            codec.m_op = op;
+            codec.m_hasDefault = var.m_size != -1 && var.m_default.m_valid;
+            with_value_type(var.m_type, [&](auto* tag) {
+                typedef typename std::remove_pointer<decltype(tag)>::type value_t;
+                static_assert(alignof(value_t) <= alignof(std::max_align_t),
+                              "SDL value type is over-aligned for the arena");
+                codec.m_valueSize = sizeof(value_t);
+                if (var.m_size > 0) {
+                    codec.m_valueOffset = align_up(size, alignof(value_t));
+                    size = codec.m_valueOffset + var.m_size * sizeof(value_t);
+                }
+            });
+        }
+        if (pass == 0)
+            desc->m_podEnd = size;
+    }
+    desc->m_arenaSize = size;
+
+    desc->m_stateVarMask.assign((desc->m_vars.size() + 63) / 64, 0);
+    desc->m_listIndex.resize(desc->m_vars.size());
+    uint32_t simpleCount = 0, sdCount = 0;
+    for (size_t i=0; i<desc->m_vars.size(); ++i) {
+        if (desc->m_vars[i].m_type == e_VarStateDesc) {
+            desc->m_stateVarMask[i / 64] |= uint64_t(1) << (i % 64);
+            desc->m_listIndex[i] = sdCount++;
+        } else {
+            desc->m_listIndex[i] = simpleCount++;
+        }
+    }
+    desc->m_compiled = true;
+
+    // Run setDefault once over a scratch arena, so new states can just
+    // copy the result.  Child states aren't touched, since their
+    // descriptors may not have been loaded yet.
+    std::vector<uint8_t> scratch(desc->m_podEnd);
+    for (VarDescriptor& var : desc->m_vars) {
+        if (!is_pod_codec(var.m_codec.m_op) || var.m_size <= 0)
+            continue;
+        Variable value;
+        value.m_data = new Variable::_ref(&var, nullptr,
+                                          scratch.data() + var.m_codec.m_valueOffset);
+        value.setDefault();
+    }
+    desc->m_defaults.assign(scratch.begin() + desc->m_podBegin, scratch.end());
+}
+
+SDL::State::_ref::_ref(SDL::StateDescriptor* desc)
+    : m_refs(1), m_desc(desc), m_flags(0), m_arena(), m_foreignVars()
+{
+    if (m_desc)
+        use_generation(m_desc->m_users);
+}
+
+SDL::State::_ref::~_ref()
+{
+    // Drop all of our references to our own arena at once, rather than
+    // one atomic decrement per variable
+    int owned = 0;
+    for (Variable& var : m_vars) {
+        if (var.m_data && var.m_data->m_arena == m_arena) {
+            var.m_data = nullptr;
+            ++owned;
+        }
+    }
+    if (owned)
+        m_arena->unref(owned);
+
+    // The variables still in m_vars hold their own arenas' generations
+    if (m_desc)
+        release_generation(m_desc->m_users);
+}
+
+void SDL::State::_ref::linkVars()
+{
+    m_simpleVars.clear();
+    m_sdVars.clear();
+    m_simpleVars.reserve(m_vars.size());
+    m_sdVars.reserve(m_vars.size());
+    for (Variable& var : m_vars) {
+        if (var.descriptor()->m_type == e_VarStateDesc)
+            m_sdVars.push_back(&var);
+        else
+            m_simpleVars.push_back(&var);
+    }
+}
+
+/* Gives this State its own variable list and dirty bitmap, still sharing
+ * the variables themselves.  That's all add() and merge() need, since
+ * they only replace variables. */
+void SDL::State::unshare()
+{
+    if (!m_data || m_data->m_refs == 1)
+        return;
+
+    _ref* copy = new _ref(m_data->m_desc);
+    copy->m_vars = m_data->m_vars;
+    copy->linkVars();
+    copy->m_object = m_data->m_object;
+    copy->m_flags = m_data->m_flags;
+    copy->m_arena = m_data->m_arena;
+    copy->m_dirty = m_data->m_dirty;
+    copy->m_foreignVars = true;
+    m_data->unref();
+    m_data = copy;
+}
+
+void SDL::State::detach()
+{
+    if (!m_data)
+        return;
+
+    // Nobody else can see our variables if we hold every reference to
+    // our arena, and haven't picked up any from elsewhere
+    if (m_data->m_refs == 1 && !m_data->m_foreignVars
+            && (!m_data->m_arena || m_data->m_arena->m_refs == int(m_data->m_vars.size())))
+        return;
+
+    SDL::State copy(m_data->m_desc);
+    for (size_t i=0; i<m_data->m_vars.size(); ++i) {
+        Variable::_ref* var = copy.m_data->m_vars[i].m_data;
+        const Variable::_ref* src = m_data->m_vars[i].m_data;
+
+        // Child states are still shared, and detach themselves when read
+        copy.m_data->m_vars[i].copy(m_data->m_vars[i]);
+        var->m_flags = src->m_flags;
+        var->m_timestamp = src->m_timestamp;
+        var->m_notificationHint = src->m_notificationHint;
+    }
+    copy.m_data->m_object = m_data->m_object;
+    copy.m_data->m_flags = m_data->m_flags;
+    copy.m_data->m_dirty = m_data->m_dirty;
+    *this = copy;
+}
+
 enum { e_HFlagVolatile = (1<<0) };
 
+/* Calls func with the index of each bit set in both bits and mask(word) */
+template <typename Mask, typename Func>
+static void for_each_dirty(const std::vector<uint64_t>& bits, Mask mask, Func func)
+{
+    for (size_t w=0; w<bits.size(); ++w) {
+        uint64_t word = bits[w] & mask(w);
+        while (word) {
+            func(w * 64 + __builtin_ctzll(word));
+            word &= word - 1;
+        }
+    }
+}
+
 void SDL::State::read(DS::Stream* stream)
 {
     if (!m_data)
         return;
 
+    detach();
     m_data->m_flags = stream->read<uint16_t>();
     if (stream->read<uint8_t>() != SDL_IOVERSION)
         throw DS::MalformedData();
@@ -886,6 +1175,7 @@ void SDL::State::read(DS::Stream* stream)
         if (idx >= m_data->m_simpleVars.size())
             throw DS::MalformedData();
         m_data->m_simpleVars[idx]->read(stream);
+        setDirty(m_data->m_simpleVars[idx] - m_data->m_vars.data());
     }
 
     count = stupidLengthRead(stream, m_data->m_desc->m_vars.size());
@@ -895,6 +1185,7 @@ void SDL::State::read(DS::Stream* stream)
         if (idx >= m_data->m_sdVars.size())
             throw DS::MalformedData();
         m_data->m_sdVars[idx]->read(stream);
+        setDirty(m_data->m_sdVars[idx] - m_data->m_vars.data());
     }
 }
 
@@ -904,35 +1195,33 @@ void SDL::State::write(DS::Stream* stream) const
     stream->write<uint16_t>(m_data->m_flags);
     stream->write<uint8_t>(SDL_IOVERSION);
 
+    const std::vector<uint64_t>& dirty = m_data->m_dirty;
+    const std::vector<uint64_t>& sdMask = m_data->m_desc->m_stateVarMask;
+    const std::vector<uint32_t>& listIndex = m_data->m_desc->m_listIndex;
+    auto simple = [&](size_t w) { return ~sdMask[w]; };
+    auto sd = [&](size_t w) { return sdMask[w]; };
+
     size_t count = 0;
-    for (size_t i=0; i<m_data->m_simpleVars.size(); ++i) {
-        if (m_data->m_simpleVars[i]->data()->m_flags & Variable::e_XIsDirty)
-            ++count;
-    }
+    for (size_t w=0; w<dirty.size(); ++w)
+        count += __builtin_popcountll(dirty[w] & ~sdMask[w]);
     stupidLengthWrite(stream, m_data->m_desc->m_vars.size(), count);
     bool useIndices = (count != m_data->m_simpleVars.size());
-    for (size_t i=0; i<m_data->m_simpleVars.size(); ++i) {
-        if (m_data->m_simpleVars[i]->data()->m_flags & Variable::e_XIsDirty) {
-            if (useIndices)
-                stupidLengthWrite(stream, m_data->m_desc->m_vars.size(), i);
-            m_data->m_simpleVars[i]->write(stream);
-        }
-    }
+    for_each_dirty(dirty, simple, [&](size_t i) {
+        if (useIndices)
+            stupidLengthWrite(stream, m_data->m_desc->m_vars.size(), listIndex[i]);
+        m_data->m_vars[i].write(stream);
+    });
 
     count = 0;
-    for (size_t i=0; i<m_data->m_sdVars.size(); ++i) {
-        if (m_data->m_sdVars[i]->data()->m_flags & Variable::e_XIsDirty)
-            ++count;
-    }
+    for (size_t w=0; w<dirty.size(); ++w)
+        count += __builtin_popcountll(dirty[w] & sdMask[w]);
     stupidLengthWrite(stream, m_data->m_desc->m_vars.size(), count);
     useIndices = (count != m_data->m_sdVars.size());
-    for (size_t i=0; i<count; ++i) {
-        if (m_data->m_sdVars[i]->data()->m_flags & Variable::e_XIsDirty) {
-            if (useIndices)
-                stupidLengthWrite(stream, m_data->m_desc->m_vars.size(), i);
-            m_data->m_sdVars[i]->write(stream);
-        }
-    }
+    for_each_dirty(dirty, sd, [&](size_t i) {
+        if (useIndices)
+            stupidLengthWrite(stream, m_data->m_desc->m_vars.size(), listIndex[i]);
+        m_data->m_vars[i].write(stream);
+    });
 }
 
 #ifdef DEBUG
@@ -943,7 +1232,7 @@ void SDL::State::debug()
 
     ST::printf(stderr, "{{{}}\n", m_data->m_desc->m_name);
     for (size_t i=0; i<m_data->m_vars.size(); ++i) {
-        if (m_data->m_vars[i].data()->m_flags & Variable::e_XIsDirty) {
+        if (isDirty(i)) {
             ST::printf(stderr, "  * {}=", m_data->m_desc->m_vars[i].m_name);
             m_data->m_vars[i].debug();
         }
@@ -951,17 +1240,45 @@ void SDL::State::debug()
 }
 #endif
 
+/* States created on either side of a descriptor reload point into
+ * different generations, even if the descriptor itself didn't change.
+ * Moves both to the latest version so they can be combined. */
+static bool match_descriptors(SDL::State& state, SDL::State& other)
+{
+    if (state.descriptor() == other.descriptor())
+        return true;
+    if (!state.descriptor() || !other.descriptor()
+            || state.descriptor()->m_name.compare_i(other.descriptor()->m_name) != 0)
+        return false;
+
+    state.update();
+    other.update();
+    return state.descriptor() == other.descriptor();
+}
+
 void SDL::State::add(const SDL::State& state)
 {
     if (!m_data)
         return;
 
-    if (state.m_data->m_desc != m_data->m_desc)
-        throw DS::MalformedData();
-    for (size_t i=0; i<m_data->m_vars.size(); ++i) {
-        if (state.m_data->m_vars[i].data()->m_flags & Variable::e_XIsDirty)
-            m_data->m_vars[i] = state.m_data->m_vars[i];
+    if (state.m_data->m_desc != m_data->m_desc) {
+        SDL::State latest = state;
+        if (!match_descriptors(*this, latest))
+            throw DS::MalformedData();
+        add(latest);
+        return;
     }
+    if (!state.isDirty())
+        return;
+
+    unshare();
+    const std::vector<uint64_t>& incoming = state.m_data->m_dirty;
+    for_each_dirty(incoming, [](size_t) { return ~uint64_t(0); }, [&](size_t i) {
+        m_data->m_vars[i] = state.m_data->m_vars[i];
+    });
+    for (size_t w=0; w<incoming.size(); ++w)
+        m_data->m_dirty[w] |= incoming[w];
+    m_data->m_foreignVars = true;
 }
 
 void SDL::State::merge(const SDL::State& state)
@@ -970,6 +1287,11 @@ void SDL::State::merge(const SDL::State& state)
         return;
 
     if (state.m_data->m_desc != m_data->m_desc) {
+        SDL::State latest = state;
+        if (match_descriptors(*this, latest)) {
+            merge(latest);
+            return;
+        }
         if (state.m_data->m_desc && m_data->m_desc) {
             ST::printf(stderr, "Stubbornly refusing to merge unrelated SDL states {} and {}\n",
                        state.m_data->m_desc->m_name, m_data->m_desc->m_name);
@@ -979,10 +1301,16 @@ void SDL::State::merge(const SDL::State& state)
         }
         return;
     }
-    for (size_t i=0; i < m_data->m_vars.size(); ++i) {
-        if (state.m_data->m_vars[i].data()->m_timestamp > m_data->m_vars[i].data()->m_timestamp)
+
+    // Only variables that were set can carry a newer timestamp
+    for_each_dirty(state.m_data->m_dirty, [](size_t) { return ~uint64_t(0); }, [&](size_t i) {
+        if (state.m_data->m_vars[i].data()->m_timestamp > m_data->m_vars[i].data()->m_timestamp) {
+            unshare();
             m_data->m_vars[i] = state.m_data->m_vars[i];
-    }
+            m_data->m_foreignVars = true;
+            setDirty(i);
+        }
+    });
 }
 
 bool SDL::State::update()
@@ -990,17 +1318,29 @@ bool SDL::State::update()
     if (!m_data)
         return false;
 
-    StateDescriptor* newdesc = DescriptorDb::FindLatestDescriptor(m_data->m_desc->m_name);
-    if (newdesc == m_data->m_desc)
-        return false;
-
-    SDL::State newstate(newdesc);
+    SDL::State newstate;
+    {
+        DescriptorDb::Lease descriptors;
+        StateDescriptor* newdesc = descriptors.findLatest(m_data->m_desc->m_name);
+        if (!newdesc || newdesc == m_data->m_desc)
+            return false;
+        newstate = SDL::State(newdesc);
+    }
     for (size_t i=0; i < newstate.m_data->m_vars.size(); ++i) {
         VarDescriptor* newdesc = newstate.m_data->m_vars[i].descriptor();
         StateDescriptor::varmap_t::iterator vari = m_data->m_desc->m_varmap.find(newdesc->m_name);
         if (vari == m_data->m_desc->m_varmap.end())
             continue;
-        newstate.m_data->m_vars[i].copy(m_data->m_vars[vari->second]);
+        Variable& newvar = newstate.m_data->m_vars[i];
+        const Variable& oldvar = m_data->m_vars[vari->second];
+        newvar.copy(oldvar);
+
+        // Keep track of what was set and when, so the upgraded state
+        // serializes and merges like the original.  Whether the value is
+        // still the default is worked out again when it's written.
+        newvar.data()->m_flags = oldvar.data()->m_flags & ~Variable::e_SameAsDefault;
+        newvar.data()->m_timestamp = oldvar.data()->m_timestamp;
+        newstate.setDirty(i, isDirty(vari->second));
     }
     newstate.m_data->ref();
     m_data->unref();
@@ -1013,6 +1353,7 @@ void SDL::State::setDefault()
     if (!m_data)
         return;
 
+    detach();
     for (auto it = m_data->m_vars.begin(); it != m_data->m_vars.end(); ++it)
         it->setDefault();
 }
@@ -1034,23 +1375,36 @@ bool SDL::State::isDirty() const
     if (!m_data)
         return false;
 
-    for (auto it = m_data->m_vars.begin(); it != m_data->m_vars.end(); ++it) {
-        if (it->data()->m_flags & Variable::e_XIsDirty)
+    for (uint64_t word : m_data->m_dirty) {
+        if (word)
             return true;
     }
     return false;
 }
 
+void SDL::State::setDirty(size_t index, bool dirty)
+{
+    DS_ASSERT(m_data && index < m_data->m_vars.size());
+
+    unshare();
+    uint64_t bit = uint64_t(1) << (index % 64);
+    if (dirty)
+        m_data->m_dirty[index / 64] |= bit;
+    else
+        m_data->m_dirty[index / 64] &= ~bit;
+}
+
 SDL::State SDL::State::Create(DS::Stream* stream)
 {
     uint16_t flags = stream->read<uint16_t>();
     if ((flags & 0x8000) == 0)
         throw DS::MalformedData();
 
-    ST::string name = stream->readSafeString();
+    char name[DS::Stream::MAX_SAFE_STRING];
+    size_t length = stream->readSafeStringBytes(name);
     int version = stream->read<int16_t>();
-    SDL::StateDescriptor* desc = SDL::DescriptorDb::FindDescriptor(name, version);
-    State state(desc);
+    // The Lease lasts until the State holds the descriptor itself
+    State state(SDL::DescriptorDb::Lease().find(name, length, version));
 
     if (state.m_data && (flags & e_HFlagVolatile) != 0)
         state.m_data->m_object.read(stream);
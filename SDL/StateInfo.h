@@ -42,6 +42,7 @@ namespace SDL
 
     struct StateDescriptor;
     struct VarDescriptor;
+    struct VarArena;
 
     class Variable
     {
@@ -54,9 +55,6 @@ namespace SDL
             e_SameAsDefault       = (1<<3),
             e_HasDirtyFlag        = (1<<4),
             e_WantTimeStamp       = (1<<5),
-
-            /* Extended (not saved) flags */
-            e_XIsDirty            = (1<<8),
         };
 
         Variable(VarDescriptor* desc = nullptr) : m_data()
@@ -104,6 +102,7 @@ namespace SDL
         {
             union
             {
+                void* m_values;
                 int32_t* m_int;
                 int16_t* m_short;
                 int8_t* m_byte;
@@ -131,15 +130,18 @@ namespace SDL
             std::atomic_int m_refs;
             VarDescriptor* m_desc;
 
-            _ref(VarDescriptor* desc);
-            ~_ref() { clear(); }
+            // Variables belonging to a State live in that state's arena,
+            // along with their values if they have a fixed size.  These
+            // are null for standalone variables.
+            VarArena* m_arena;
+            void* m_inline;
 
-            void ref() { ++m_refs; }
-            void unref()
-            {
-                if (--m_refs == 0)
-                    delete this;
-            }
+            _ref(VarDescriptor* desc, VarArena* arena = nullptr,
+                 void* inlineValues = nullptr);
+            ~_ref();
+
+            void ref();
+            void unref();
 
             void resize(size_t size);
             void clear();
@@ -148,8 +150,13 @@ namespace SDL
             void write(DS::Stream* stream) const;
 
             friend class Variable;
+            friend class State;
+            friend struct VarArena;
         }* m_data;
 
+        friend class State;
+        friend struct VarArena;
+
     public:
         VarDescriptor* descriptor() const { return m_data ? m_data->m_desc : nullptr; }
         _ref* data() const { return m_data; }
@@ -196,8 +203,26 @@ namespace SDL
         bool isDefault() const;
         bool isDirty() const;
 
+        /* Copies of a State share its data until one of them is changed.
+         * Anything changing variables in place through data() must call
+         * detach() first, so other holders keep seeing the old values. */
+        void detach();
+
+        /* Marks the variable at index (in descriptor order) to be sent by
+         * write() and copied by add() and merge() */
+        void setDirty(size_t index, bool dirty = true);
+        bool isDirty(size_t index) const
+        {
+            return (m_data->m_dirty[index / 64] >> (index % 64)) & 1;
+        }
+
         static State Create(DS::Stream* stream);
 
+        /* Lays out desc's variables and picks their codecs.  Must be done
+         * once before any State uses the descriptor; DescriptorDb does
+         * this for everything it loads. */
+        static void Compile(StateDescriptor* desc);
+
         DS::Blob toBlob() const;
         static State FromBlob(const DS::Blob& blob)
         {
@@ -221,9 +246,19 @@ namespace SDL
             std::vector<Variable*> m_simpleVars, m_sdVars;
             MOUL::Uoid m_object;
             uint16_t m_flags;
+            VarArena* m_arena;
 
-            _ref(StateDescriptor* desc)
-                : m_refs(1), m_desc(desc), m_flags(0) { }
+            // One bit per entry in m_vars.  This isn't kept in the arena,
+            // since add() can replace every variable and release it.
+            std::vector<uint64_t> m_dirty;
+
+            // Set once m_vars holds variables from another State's arena
+            bool m_foreignVars;
+
+            _ref(StateDescriptor* desc);
+            ~_ref();
+
+            void linkVars();
 
             void ref() { ++m_refs; }
             void unref()
@@ -233,6 +268,8 @@ namespace SDL
             }
         }* m_data;
 
+        void unshare();
+
     public:
         StateDescriptor* descriptor() const { return m_data ? m_data->m_desc : nullptr; }
         _ref* data() const { return m_data; }
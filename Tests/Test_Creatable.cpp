@@ -0,0 +1,188 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "factory.h"
+#include "NetMessages/NetMsgGameMessage.h"
+#include "NetMessages/NetMsgSDLState.h"
+#include "NetMessages/NetMsgObject.h"
+#include "Messages/ServerReplyMsg.h"
+#include "Avatar/AvBrainGeneric.h"
+#include "Avatar/AvTask.h"
+#include "GameServ/GameServer.h"
+#include "errors.h"
+
+TEST_CASE("Test MOUL::Creatable::Cast", "[creatable]")
+{
+    MOUL::Creatable* directed = MOUL::Factory::Create(MOUL::ID_NetMsgGameMessageDirected);
+    CHECK(directed->Cast<MOUL::NetMsgGameMessageDirected>() != nullptr);
+    CHECK(directed->Cast<MOUL::NetMsgGameMessage>() != nullptr);
+    CHECK(directed->Cast<MOUL::NetMessage>() != nullptr);
+    CHECK(directed->Cast<MOUL::Message>() == nullptr);
+    CHECK(directed->Cast<MOUL::NetMsgSDLState>() == nullptr);
+    directed->unref();
+
+    MOUL::Creatable* state = MOUL::Factory::Create(MOUL::ID_NetMsgSDLState);
+    CHECK(state->Cast<MOUL::NetMsgSDLState>() != nullptr);
+    CHECK(state->Cast<MOUL::NetMsgSDLStateBCast>() == nullptr);
+    state->unref();
+
+    MOUL::Creatable* reply = MOUL::Factory::Create(MOUL::ID_ServerReplyMsg);
+    CHECK(reply->Cast<MOUL::Message>() == static_cast<MOUL::Message*>(
+            static_cast<MOUL::ServerReplyMsg*>(reply)));
+    CHECK(reply->Cast<MOUL::NetMessage>() == nullptr);
+    reply->unref();
+
+    MOUL::Creatable* brain = MOUL::Factory::Create(MOUL::ID_AvBrainGeneric);
+    CHECK(brain->Cast<MOUL::ArmatureBrain>() != nullptr);
+    CHECK(brain->Cast<MOUL::AvTask>() == nullptr);
+    brain->unref();
+}
+
+#ifndef DS_NO_CREATABLE_POOL
+TEST_CASE("Test MOUL creatable pooling", "[creatable]")
+{
+    MOUL::Creatable* first = MOUL::Factory::Create(MOUL::ID_ServerReplyMsg);
+    void* storage = first;
+    first->unref();
+
+    // The freed block is handed back for the next object of the same type
+    MOUL::Creatable* second = MOUL::Factory::Create(MOUL::ID_ServerReplyMsg);
+    CHECK(static_cast<void*>(second) == storage);
+    CHECK(second->Cast<MOUL::ServerReplyMsg>()->m_reply == MOUL::ServerReplyMsg::e_Invalid);
+    second->unref();
+}
+#endif
+
+TEST_CASE("Test reading truncated game messages", "[creatable]")
+{
+    MOUL::NetMsgGameMessage* gameMsg = MOUL::NetMsgGameMessage::Create();
+    gameMsg->m_message = MOUL::ServerReplyMsg::Create();
+    DS::BufferStream out;
+    MOUL::Factory::WriteCreatable(&out, gameMsg);
+    gameMsg->unref();
+
+    DS::Blob whole(out.buffer(), out.size());
+    MOUL::NetMessage* parsed = DS::GameServer_ReadMessage(whole, MOUL::ID_NetMsgGameMessage);
+    REQUIRE(parsed);
+    CHECK(parsed->Cast<MOUL::NetMsgGameMessage>() != nullptr);
+    parsed->unref();
+
+    // Every prefix fails to parse; none of them may bring the server down
+    for (size_t size = 0; size < out.size(); ++size) {
+        DS::Blob truncated(out.buffer(), size);
+        CHECK(DS::GameServer_ReadMessage(truncated, MOUL::ID_NetMsgGameMessage) == nullptr);
+    }
+}
+
+TEST_CASE("Test MOUL parsing from shared buffers", "[creatable]")
+{
+    MOUL::NetMsgSDLStateBCast* state = MOUL::NetMsgSDLStateBCast::Create();
+    state->m_sdlBlob = DS::Blob::FromString("SDL state payload");
+    DS::BufferStream out;
+    MOUL::Factory::WriteCreatable(&out, state);
+    state->unref();
+
+    DS::SharedBuffer* shared = DS::SharedBuffer::Create(out.size());
+    memcpy(shared->data(), out.buffer(), out.size());
+
+    SECTION("Payloads view the shared receive buffer") {
+        DS::Blob message = DS::Blob::Share(shared);
+        shared->unref();
+        DS::BlobStream stream(message);
+        auto parsed = MOUL::Factory::Read<MOUL::NetMsgSDLStateBCast>(&stream);
+        REQUIRE(parsed);
+        CHECK(parsed->m_sdlBlob.isShared());
+        CHECK(parsed->m_sdlBlob.buffer() > message.buffer());
+        CHECK(parsed->m_sdlBlob.buffer() < message.buffer() + message.size());
+
+        // The view keeps the storage alive after the original blob is gone
+        message = DS::Blob();
+        CHECK(memcmp(parsed->m_sdlBlob.buffer(), "SDL state payload",
+                     parsed->m_sdlBlob.size()) == 0);
+        parsed->unref();
+    }
+
+    SECTION("Payloads from ordinary blobs are copied") {
+        DS::Blob message(shared->data(), shared->size());
+        shared->unref();
+        DS::BlobStream stream(message);
+        auto parsed = MOUL::Factory::Read<MOUL::NetMsgSDLStateBCast>(&stream);
+        REQUIRE(parsed);
+        CHECK_FALSE(parsed->m_sdlBlob.isShared());
+        CHECK(parsed->m_sdlBlob.size() == 17);
+        parsed->unref();
+    }
+}
+
+TEST_CASE("Test MOUL::NetMsgStream compression policy", "[creatable]")
+{
+    uint8_t payload[512];
+    for (size_t i = 0; i < sizeof(payload); ++i)
+        payload[i] = uint8_t(i % 8);
+
+    auto roundTrip = [&payload](MOUL::NetMsgStream::Compression compression) {
+        DS::BufferStream out;
+        MOUL::NetMsgStream::Write(&out, compression, payload, sizeof(payload));
+        out.seek(0, SEEK_SET);
+        MOUL::NetMsgStream msgStream;
+        msgStream.read(&out);
+        CHECK(msgStream.m_data.size() == sizeof(payload));
+        CHECK(memcmp(msgStream.m_data.buffer(), payload, sizeof(payload)) == 0);
+        return std::make_pair(msgStream.m_compression, out.size());
+    };
+
+    MOUL::NetMsgStream::SetCompressThreshold(0);
+    auto plain = roundTrip(MOUL::NetMsgStream::e_CompressNone);
+    CHECK(plain.first == MOUL::NetMsgStream::e_CompressNone);
+    CHECK(plain.second == sizeof(payload) + 9);
+
+    MOUL::NetMsgStream::SetCompressThreshold(256);
+    auto compressed = roundTrip(MOUL::NetMsgStream::e_CompressNone);
+    CHECK(compressed.first == MOUL::NetMsgStream::e_CompressZlib);
+    CHECK(compressed.second < plain.second);
+
+    auto never = roundTrip(MOUL::NetMsgStream::e_CompressNever);
+    CHECK(never.first == MOUL::NetMsgStream::e_CompressNever);
+
+    MOUL::NetMsgStream::SetCompressThreshold(1024);
+    CHECK(roundTrip(MOUL::NetMsgStream::e_CompressNone).first
+          == MOUL::NetMsgStream::e_CompressNone);
+
+    MOUL::NetMsgStream::SetCompressThreshold(0);
+}
+
+TEST_CASE("Test MOUL::NetMsgStream size mismatches", "[creatable]")
+{
+    uint8_t payload[512];
+    for (size_t i = 0; i < sizeof(payload); ++i)
+        payload[i] = uint8_t(i % 8);
+
+    DS::BufferStream out;
+    MOUL::NetMsgStream::Write(&out, MOUL::NetMsgStream::e_CompressZlib,
+                              payload, sizeof(payload));
+
+    // The compressed data must inflate to exactly the declared size
+    for (uint32_t declared : { uint32_t(sizeof(payload) - 1), uint32_t(sizeof(payload) + 1) }) {
+        DS::BufferStream bad(out.buffer(), out.size());
+        bad.write<uint32_t>(declared);
+        bad.seek(0, SEEK_SET);
+        MOUL::NetMsgStream msgStream;
+        CHECK_THROWS_AS(msgStream.read(&bad), DS::MalformedData);
+    }
+}
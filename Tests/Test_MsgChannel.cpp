@@ -0,0 +1,78 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include <catch2/catch.hpp>
+
+#include "NetIO/MsgChannel.h"
+
+TEST_CASE("Test DS::MsgChannel coalescing", "[msgchannel]")
+{
+    DS::MsgChannel channel;
+    int payloads[4];
+
+    SECTION("Keyed messages supersede queued ones") {
+        CHECK(channel.putOrReplace(1, &payloads[0], 42) == nullptr);
+        channel.putMessage(1, &payloads[1]);
+        CHECK(channel.putOrReplace(1, &payloads[2], 42) == &payloads[0]);
+
+        // The replacement goes to the back of the queue, not the old slot
+        CHECK(channel.getMessage().m_payload == &payloads[1]);
+        CHECK(channel.getMessage().m_payload == &payloads[2]);
+        CHECK_FALSE(channel.hasMessage());
+    }
+
+    SECTION("Replacements don't overtake later messages") {
+        CHECK(channel.putOrReplace(1, &payloads[0], 42) == nullptr);
+        channel.putMessage(2, &payloads[1]);
+        CHECK(channel.putOrReplace(1, &payloads[2], 43) == nullptr);
+        CHECK(channel.putOrReplace(1, &payloads[3], 42) == &payloads[0]);
+
+        // Everything is still delivered in the order it was last queued
+        DS::FifoMessage msg = channel.getMessage();
+        CHECK(msg.m_messageType == 2);
+        CHECK(msg.m_payload == &payloads[1]);
+        CHECK(channel.getMessage().m_payload == &payloads[2]);
+        CHECK(channel.getMessage().m_payload == &payloads[3]);
+        CHECK_FALSE(channel.hasMessage());
+    }
+
+    SECTION("Different keys and types are kept") {
+        CHECK(channel.putOrReplace(1, &payloads[0], 42) == nullptr);
+        CHECK(channel.putOrReplace(1, &payloads[1], 43) == nullptr);
+        CHECK(channel.putOrReplace(2, &payloads[2], 42) == nullptr);
+        CHECK(channel.getMessage().m_payload == &payloads[0]);
+        CHECK(channel.getMessage().m_payload == &payloads[1]);
+        CHECK(channel.getMessage().m_payload == &payloads[2]);
+    }
+
+    SECTION("Sent messages are not replaced") {
+        CHECK(channel.putOrReplace(1, &payloads[0], 42) == nullptr);
+        CHECK(channel.getMessage().m_payload == &payloads[0]);
+        CHECK(channel.putOrReplace(1, &payloads[1], 42) == nullptr);
+        CHECK(channel.getMessage().m_payload == &payloads[1]);
+    }
+
+    SECTION("Unkeyed messages never coalesce") {
+        channel.putMessage(1, &payloads[0]);
+        CHECK(channel.putOrReplace(1, &payloads[1], 42) == nullptr);
+        CHECK(channel.putOrReplace(1, &payloads[2], 0) == nullptr);
+        CHECK(channel.putOrReplace(1, &payloads[3], 42) == &payloads[1]);
+        CHECK(channel.getMessage().m_payload == &payloads[0]);
+        CHECK(channel.getMessage().m_payload == &payloads[2]);
+        CHECK(channel.getMessage().m_payload == &payloads[3]);
+    }
+}
@@ -54,15 +54,53 @@ static const ST::string s_SdlDescriptor = ST_LITERAL(R"(
     {
         VERSION 1
     }
+
+    STATEDESC Mixed
+    {
+        VERSION 1
+
+        VAR STRING32 sName[1]       DEFAULT="Relto"
+        VAR INT      iList[]
+        VAR POINT3   pPos[2]
+        VAR BYTE     bFlag[1]       DEFAULT=7
+        VAR $Barney  child[1]
+    }
+
+    STATEDESC Child
+    {
+        VERSION 1
+
+        VAR INT      iValue[1]      DEFAULT=0
+    }
+
+    STATEDESC Parent
+    {
+        VERSION 1
+
+        VAR $Child   children[2]
+    }
 )");
 
+static ST::string WriteDescriptors(const char* sdlDir)
+{
+    ST::string sdlFilePath = ST::format("{}/Test.sdl", sdlDir);
+    FILE* f = fopen(sdlFilePath.c_str(), "w+");
+    if (!f) {
+        fprintf(stderr, "Failed to create a file in our temporary SDL directory.\n");
+        return ST::string();
+    }
+    fwrite(s_SdlDescriptor.c_str(), sizeof(char), s_SdlDescriptor.size(), f);
+    fclose(f);
+    return sdlFilePath;
+}
+
 static bool LoadDescriptors()
 {
     static bool result = false;
     if (result)
         return true;
 
-    ST::string sdlFilePath;
+    ST::string sdlFilePath, cachePath;
     char tempDir[256] = "/tmp/DirtSandSDLTestXXXXXX";
     char* tempDirResult = nullptr;
     do {
@@ -72,26 +110,44 @@ static bool LoadDescriptors()
             break;
         }
 
-        sdlFilePath = ST::format("{}/Test.sdl", tempDirResult);
-        FILE* f = fopen(sdlFilePath.c_str(), "w+");
-        if (!f) {
-            fprintf(stderr, "Failed to create a file in our temporary SDL directory.\n");
+        sdlFilePath = WriteDescriptors(tempDirResult);
+        if (sdlFilePath.empty())
             break;
-        }
-        fwrite(s_SdlDescriptor.c_str(), sizeof(char), s_SdlDescriptor.size(), f);
-        fclose(f);
 
-        SDL::DescriptorDb::LoadDescriptors(tempDirResult);
+        // The second load replaces everything with what was read back
+        // from the cache, so the tests below check that too
+        cachePath = ST::format("{}/sdl.cache", tempDirResult);
+        SDL::DescriptorDb::LoadDescriptors(tempDirResult, cachePath);
+        if (access(cachePath.c_str(), F_OK) < 0) {
+            fprintf(stderr, "Failed to write the SDL descriptor cache.\n");
+            break;
+        }
+        SDL::DescriptorDb::LoadDescriptors(tempDirResult, cachePath);
         result = true;
     } while (0);
 
     if (!sdlFilePath.empty())
         unlink(sdlFilePath.c_str());
+    if (!cachePath.empty())
+        unlink(cachePath.c_str());
     if (tempDirResult)
         rmdir(tempDirResult);
     return result;
 }
 
+static bool ReloadDescriptors()
+{
+    char tempDir[256] = "/tmp/DirtSandSDLTestXXXXXX";
+    if (!mkdtemp(tempDir))
+        return false;
+    ST::string sdlFilePath = WriteDescriptors(tempDir);
+    bool loaded = !sdlFilePath.empty() && SDL::DescriptorDb::LoadDescriptors(tempDir);
+    if (!sdlFilePath.empty())
+        unlink(sdlFilePath.c_str());
+    rmdir(tempDir);
+    return loaded;
+}
+
 #define CHECK_VAR_DESCRIPTOR(desc, name, varType, varMember, defaultValue)                      \
     SECTION("VarDescriptor (" #desc ")" name) {                                                 \
         auto varIt = desc->m_varmap.find(name);                                                 \
@@ -159,7 +215,8 @@ static bool LoadDescriptors()
 
 static SDL::State CreateState()
 {
-    SDL::StateDescriptor* desc = SDL::DescriptorDb::FindDescriptor("Test", 1);
+    SDL::DescriptorDb::Lease descriptors;
+    SDL::StateDescriptor* desc = descriptors.find("Test", 1);
     REQUIRE(desc != nullptr);
 
     auto boolVarIdx = desc->m_varmap.find("bTestVar1");
@@ -180,8 +237,9 @@ TEST_CASE("Test SDL", "[sdl]")
     REQUIRE(LoadDescriptors());
 
     SECTION("SDL Descriptors") {
-        SDL::StateDescriptor* v1 = SDL::DescriptorDb::FindDescriptor("Test", 1);
-        SDL::StateDescriptor* v2 = SDL::DescriptorDb::FindDescriptor("Test", 2);
+        SDL::DescriptorDb::Lease descriptors;
+        SDL::StateDescriptor* v1 = descriptors.find("Test", 1);
+        SDL::StateDescriptor* v2 = descriptors.find("Test", 2);
 
         REQUIRE(v1 != nullptr);
         CHECK(v1->m_version == 1);
@@ -204,6 +262,15 @@ TEST_CASE("Test SDL", "[sdl]")
         CHECK_VAR_DESCRIPTOR(v2, "iTestVar3", SDL::e_VarInt, m_int, 0);
         CHECK_VAR_DESCRIPTOR(v2, "iTestVar4", SDL::e_VarInt, m_int, 100);
         CHECK_VAR_DESCRIPTOR(v2, "bTestVar5", SDL::e_VarByte, m_int, 50);
+
+        CHECK(descriptors.find("Test", -1) == v2);
+        CHECK(descriptors.findLatest("Test") == v2);
+
+        CHECK(v1->m_id != 0);
+        CHECK(v1->m_id == v2->m_id);
+        CHECK(descriptors.find("Barney", 1)->m_id != v1->m_id);
+        CHECK(descriptors.find("Test", 4, 1) == v1);
+        CHECK(descriptors.find("TEST", 4, -1) == v2);
     }
 
     SECTION("SDL Blob Round Tripping") {
@@ -216,6 +283,144 @@ TEST_CASE("Test SDL", "[sdl]")
         CHECK(memcmp(newBlob.buffer(), origBlob.buffer(), origBlob.size()) == 0);
     }
 
+    SECTION("SDL Mixed Variable Storage") {
+        SDL::DescriptorDb::Lease descriptors;
+        SDL::StateDescriptor* desc = descriptors.find("Mixed", 1);
+        REQUIRE(desc != nullptr);
+        REQUIRE(desc->m_vars.size() == 5);
+
+        SDL::State state(desc);
+        auto* name = state.data()->m_vars[desc->m_varmap["sName"]].data();
+        auto* list = state.data()->m_vars[desc->m_varmap["iList"]].data();
+        auto* pos = state.data()->m_vars[desc->m_varmap["pPos"]].data();
+        CHECK(name->m_string[0] == "Relto");
+        CHECK(state.data()->m_vars[desc->m_varmap["bFlag"]].data()->m_byte[0] == 7);
+        CHECK(list->m_size == 0);
+        CHECK(pos->m_size == 2);
+
+        pos->m_vector[1].m_Z = 42.0f;
+        state.setDirty(desc->m_varmap["sName"]);
+        state.setDirty(desc->m_varmap["pPos"]);
+        pos->m_flags &= ~SDL::Variable::e_SameAsDefault;
+
+        SDL::State copy = SDL::State::FromBlob(state.toBlob());
+        CHECK(copy.data()->m_vars[desc->m_varmap["sName"]].data()->m_string[0] == "Relto");
+        SDL::Variable kept = copy.data()->m_vars[desc->m_varmap["pPos"]];
+        copy = SDL::State();
+
+        // Variables keep the storage of the state they came from alive
+        REQUIRE(kept.data()->m_size == 2);
+        CHECK(kept.data()->m_vector[1].m_Z == 42.0f);
+    }
+
+    SECTION("SDL Dirty Tracking") {
+        SDL::DescriptorDb::Lease descriptors;
+        SDL::StateDescriptor* desc = descriptors.find("Mixed", 1);
+        REQUIRE(desc != nullptr);
+        int nameIdx = desc->m_varmap["sName"];
+        int flagIdx = desc->m_varmap["bFlag"];
+
+        SDL::State change(desc);
+        CHECK_FALSE(change.isDirty());
+        change.data()->m_vars[nameIdx].data()->m_string[0] = ST_LITERAL("Cleft");
+        change.data()->m_vars[nameIdx].data()->m_flags &= ~SDL::Variable::e_SameAsDefault;
+        change.setDirty(nameIdx);
+        change = SDL::State::FromBlob(change.toBlob());
+        CHECK(change.isDirty(nameIdx));
+        CHECK_FALSE(change.isDirty(flagIdx));
+
+        // Only the variables that were sent are copied
+        SDL::State state(desc);
+        state.data()->m_vars[flagIdx].data()->m_byte[0] = 3;
+        state.add(change);
+        CHECK(state.isDirty(nameIdx));
+        CHECK_FALSE(state.isDirty(flagIdx));
+        CHECK(state.data()->m_vars[nameIdx].data()->m_string[0] == "Cleft");
+        CHECK(state.data()->m_vars[flagIdx].data()->m_byte[0] == 3);
+
+        SDL::State newer(desc);
+        newer.data()->m_vars[flagIdx].data()->m_byte[0] = 9;
+        newer.data()->m_vars[flagIdx].data()->m_timestamp.setNow();
+        newer.setDirty(flagIdx);
+        state.merge(newer);
+        CHECK(state.isDirty(flagIdx));
+        CHECK(state.data()->m_vars[flagIdx].data()->m_byte[0] == 9);
+        CHECK(state.data()->m_vars[nameIdx].data()->m_string[0] == "Cleft");
+
+        // Variables the other state never set aren't taken, even if their
+        // timestamps are newer
+        SDL::State unsent(desc);
+        unsent.data()->m_vars[nameIdx].data()->m_string[0] = ST_LITERAL("Gahreesen");
+        unsent.data()->m_vars[nameIdx].data()->m_timestamp.setNow();
+        state.merge(unsent);
+        CHECK(state.data()->m_vars[nameIdx].data()->m_string[0] == "Cleft");
+    }
+
+    SECTION("SDL Partially Dirty State Arrays") {
+        SDL::DescriptorDb::Lease descriptors;
+        SDL::StateDescriptor* desc = descriptors.find("Parent", 1);
+        REQUIRE(desc != nullptr);
+        int childrenIdx = desc->m_varmap["children"];
+
+        SDL::State state(desc);
+        auto* children = state.data()->m_vars[childrenIdx].data();
+        REQUIRE(children->m_size == 2);
+        SDL::State& second = children->m_child[1];
+        second.data()->m_vars[0].data()->m_int[0] = 5;
+        second.data()->m_vars[0].data()->m_flags &= ~SDL::Variable::e_SameAsDefault;
+        second.setDirty(0);
+        state.setDirty(childrenIdx);
+
+        // Only the dirty child is written, so it has to be sent with its index
+        SDL::State copy = SDL::State::FromBlob(state.toBlob());
+        auto* copied = copy.data()->m_vars[childrenIdx].data();
+        REQUIRE(copied->m_size == 2);
+        CHECK_FALSE(copied->m_child[0].isDirty());
+        CHECK(copied->m_child[1].isDirty());
+        CHECK(copied->m_child[1].data()->m_vars[0].data()->m_int[0] == 5);
+    }
+
+    SECTION("SDL Copy on Write") {
+        SDL::DescriptorDb::Lease descriptors;
+        SDL::StateDescriptor* desc = descriptors.find("Mixed", 1);
+        REQUIRE(desc != nullptr);
+        int nameIdx = desc->m_varmap["sName"];
+        int flagIdx = desc->m_varmap["bFlag"];
+
+        SDL::State change(desc);
+        change.data()->m_vars[nameIdx].data()->m_string[0] = ST_LITERAL("Cleft");
+        change.setDirty(nameIdx);
+
+        SDL::State orig(desc);
+        SDL::State snapshot = orig;
+        orig.add(change);
+        CHECK(orig.isDirty(nameIdx));
+        CHECK_FALSE(snapshot.isDirty());
+        CHECK(snapshot.data()->m_vars[nameIdx].data()->m_string[0] == "Relto");
+
+        // Variables taken from another state are copied before changing
+        orig.detach();
+        orig.data()->m_vars[nameIdx].data()->m_string[0] = ST_LITERAL("Teledahn");
+        orig.data()->m_vars[flagIdx].data()->m_byte[0] = 1;
+        CHECK(orig.isDirty(nameIdx));
+        CHECK(change.data()->m_vars[nameIdx].data()->m_string[0] == "Cleft");
+        CHECK(snapshot.data()->m_vars[flagIdx].data()->m_byte[0] == 7);
+
+        // Nothing else can see this one, so it stays put
+        auto* data = orig.data();
+        orig.detach();
+        CHECK(orig.data() == data);
+
+        // Writing a state out doesn't change the variables it may share
+        SDL::State written(desc);
+        auto* flag = written.data()->m_vars[flagIdx].data();
+        flag->m_flags &= ~SDL::Variable::e_SameAsDefault;
+        written.setDirty(flagIdx);
+        SDL::State sharer = written;
+        sharer.toBlob();
+        CHECK_FALSE(flag->m_flags & SDL::Variable::e_SameAsDefault);
+    }
+
     SECTION("SDL Blob Upgrade") {
         SDL::State origState = CreateState();
         SDL::State newState = origState;
@@ -223,4 +428,89 @@ TEST_CASE("Test SDL", "[sdl]")
         CHECK_VAR_VALUES(origState, newState, "bTestVar1");
         CHECK_VAR_VALUES(origState, newState, "iTestVar3");
     }
+
+    SECTION("SDL Descriptor Reload") {
+        SDL::State origState = CreateState();
+        SDL::StateDescriptor* origDesc = origState.descriptor();
+        uint32_t generation = SDL::DescriptorDb::Generation();
+
+        REQUIRE(ReloadDescriptors());
+
+        CHECK(SDL::DescriptorDb::Generation() == generation + 1);
+        SDL::DescriptorDb::Lease descriptors;
+        SDL::StateDescriptor* latest = descriptors.find("Test", -1);
+        REQUIRE(latest != nullptr);
+        CHECK(descriptors.find("Test", 1) != origDesc);
+        CHECK(latest->m_id == origDesc->m_id);
+
+        // States from before the reload still work, and are moved to the
+        // new descriptors when combined with newer ones
+        SDL::State newState(descriptors.find("Test", 1));
+        CHECK(newState.descriptor() != origDesc);
+        auto* newVar = newState.data()->m_vars[newState.descriptor()->m_varmap["iTestVar4"]].data();
+        newVar->m_int[0] = 42;
+        newState.setDirty(newState.descriptor()->m_varmap["iTestVar4"]);
+        origState.add(newState);
+        CHECK(origState.descriptor() == latest);
+        SDL::State expected = CreateState();
+        CHECK_VAR_VALUES(newState, origState, "iTestVar4");
+        CHECK_VAR_VALUES(expected, origState, "iTestVar3");
+    }
+
+    SECTION("SDL Descriptor Cache With Parse Errors") {
+        char tempDir[256] = "/tmp/DirtSandSDLTestXXXXXX";
+        REQUIRE(mkdtemp(tempDir));
+        ST::string sdlFilePath = WriteDescriptors(tempDir);
+        ST::string brokenPath = ST::format("{}/Broken.sdl", tempDir);
+        if (FILE* f = fopen(brokenPath.c_str(), "w")) {
+            fputs("STATEDESC Broken\n{\n    VERSION 1\n    VAR INT\n", f);
+            fclose(f);
+        }
+        ST::string cachePath = ST::format("{}/sdl.cache", tempDir);
+        bool loaded = SDL::DescriptorDb::LoadDescriptors(tempDir, cachePath);
+        bool cached = access(cachePath.c_str(), F_OK) == 0;
+        unlink(cachePath.c_str());
+        unlink(brokenPath.c_str());
+        if (!sdlFilePath.empty())
+            unlink(sdlFilePath.c_str());
+        rmdir(tempDir);
+
+        // The good files are still loaded, but the incomplete set isn't
+        // cached, so the error shows up again on the next start
+        CHECK(loaded);
+        CHECK_FALSE(cached);
+        CHECK(SDL::DescriptorDb::Lease().find("Test", 2) != nullptr);
+    }
+
+    SECTION("SDL Descriptor Generation Reclaim") {
+        {
+            // A replaced generation is kept while a State uses it...
+            SDL::State held = CreateState();
+            REQUIRE(ReloadDescriptors());
+            REQUIRE(ReloadDescriptors());
+            CHECK(SDL::DescriptorDb::RetainedGenerations() == 1);
+            CHECK(held.toBlob().size() != 0);
+        }
+
+        // ...and freed by a later load once nothing does
+        REQUIRE(ReloadDescriptors());
+        CHECK(SDL::DescriptorDb::RetainedGenerations() == 0);
+
+        {
+            // A looked up descriptor stays valid for as long as its Lease,
+            // even before anything has been made from it
+            SDL::DescriptorDb::Lease descriptors;
+            SDL::StateDescriptor* desc = descriptors.find("Test", 1);
+            REQUIRE(desc != nullptr);
+            REQUIRE(ReloadDescriptors());
+            REQUIRE(ReloadDescriptors());
+            CHECK(SDL::DescriptorDb::RetainedGenerations() == 1);
+
+            SDL::State late(desc);
+            CHECK(late.descriptor() == desc);
+            CHECK(late.toBlob().size() != 0);
+        }
+        REQUIRE(ReloadDescriptors());
+        CHECK(SDL::DescriptorDb::RetainedGenerations() == 0);
+    }
 }
@@ -23,7 +23,8 @@ void DS::BitVector::set(size_t idx, bool bit)
         size_t moreWords = (idx / 32) + 1;
         uint32_t* moreBits = new uint32_t[moreWords];
         memset(moreBits, 0, moreWords * sizeof(uint32_t));
-        memcpy(moreBits, m_bits, m_words * sizeof(uint32_t));
+        if (m_bits)
+            memcpy(moreBits, m_bits, m_words * sizeof(uint32_t));
         delete[] m_bits;
         m_bits = moreBits;
         m_words = moreWords;
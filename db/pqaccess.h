@@ -15,7 +15,11 @@
  * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
  ******************************************************************************/
 
+#ifndef _DS_PQACCESS_H
+#define _DS_PQACCESS_H
+
 #include "Types/Uuid.h"
+#include <string_theory/stdio>
 #include <libpq-fe.h>
 
 namespace DS
@@ -116,6 +120,18 @@ namespace DS
         return PQexecParams(conn, command, sizeof...(args), nullptr,
                             params.m_values, nullptr, nullptr, 0);
     }
+
+    /* Like PQexecVA, but only sends the query.  The results must be read
+     * with PQgetResult until it returns nullptr before the connection can
+     * be used again. */
+    template <typename... ArgsT>
+    bool PQsendVA(PGconn* conn, const char* command, ArgsT&&... args)
+    {
+        PostgresStrings<sizeof...(args)> params;
+        params.set_all(std::forward<ArgsT>(args)...);
+        return PQsendQueryParams(conn, command, sizeof...(args), nullptr,
+                                 params.m_values, nullptr, nullptr, 0) != 0;
+    }
 }
 
 static inline void check_postgres(PGconn* postgres)
@@ -135,3 +151,5 @@ static inline void check_postgres(PGconn* postgres)
 #define PQ_PRINT_ERROR(pq, action)                                      \
     ST::printf(stderr, "{}:{}:\n    Postgres " #action " error: {}\n",  \
                __FILE__, __LINE__, PQerrorMessage(pq))
+
+#endif
@@ -0,0 +1,128 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#include "pqpool.h"
+#include "settings.h"
+
+#include <chrono>
+
+DS::PostgresPool::PostgresPool(size_t maxConnections)
+    : m_open(), m_max(maxConnections ? maxConnections : 1), m_stats()
+{ }
+
+DS::PostgresPool::~PostgresPool()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_idle.size() != m_open) {
+        ST::printf(stderr, "[DB] WARNING: {} postgres connections still in use\n",
+                   m_open - m_idle.size());
+    }
+    for (PGconn* conn : m_idle)
+        PQfinish(conn);
+}
+
+PGconn* DS::PostgresPool::connect()
+{
+    PGconn* conn = PQconnectdb(ST::format(
+                    "host='{}' port='{}' user='{}' password='{}' dbname='{}'",
+                    DS::Settings::DbHostname(), DS::Settings::DbPort(),
+                    DS::Settings::DbUsername(), DS::Settings::DbPassword(),
+                    DS::Settings::DbDbaseName()).c_str());
+    if (PQstatus(conn) != CONNECTION_OK) {
+        ST::printf(stderr, "Error connecting to postgres: {}", PQerrorMessage(conn));
+        PQfinish(conn);
+        return nullptr;
+    }
+    return conn;
+}
+
+void DS::PostgresPool::warmup(size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            if (m_open >= m_max)
+                return;
+            ++m_open;
+        }
+
+        PGconn* conn = connect();
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (!conn) {
+            --m_open;
+            return;
+        }
+        m_idle.push_back(conn);
+    }
+    m_cond.notify_all();
+}
+
+PGconn* DS::PostgresPool::acquire()
+{
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++m_stats.m_acquires;
+    if (m_idle.empty() && m_open >= m_max) {
+        ++m_stats.m_waits;
+        m_cond.wait(lock, [this] { return !m_idle.empty() || m_open < m_max; });
+    }
+
+    PGconn* conn = nullptr;
+    if (!m_idle.empty()) {
+        conn = m_idle.back();
+        m_idle.pop_back();
+    } else {
+        // Don't hold up everyone else while the new connection is made
+        ++m_open;
+        lock.unlock();
+        conn = connect();
+        lock.lock();
+        if (!conn) {
+            --m_open;
+            m_cond.notify_one();
+            return nullptr;
+        }
+    }
+
+    uint64_t waitUsec = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    m_stats.m_totalWaitUsec += waitUsec;
+    if (waitUsec > m_stats.m_maxWaitUsec)
+        m_stats.m_maxWaitUsec = waitUsec;
+    lock.unlock();
+
+    check_postgres(conn);
+    return conn;
+}
+
+void DS::PostgresPool::release(PGconn* conn)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_idle.push_back(conn);
+    }
+    m_cond.notify_one();
+}
+
+DS::PostgresPool::Stats DS::PostgresPool::stats()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    Stats stats = m_stats;
+    stats.m_open = m_open;
+    stats.m_idle = m_idle.size();
+    return stats;
+}
@@ -0,0 +1,82 @@
+/******************************************************************************
+ * This file is part of dirtsand.                                             *
+ *                                                                            *
+ * dirtsand is free software: you can redistribute it and/or modify           *
+ * it under the terms of the GNU Affero General Public License as             *
+ * published by the Free Software Foundation, either version 3 of the         *
+ * License, or (at your option) any later version.                            *
+ *                                                                            *
+ * dirtsand is distributed in the hope that it will be useful,                *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of             *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the              *
+ * GNU Affero General Public License for more details.                        *
+ *                                                                            *
+ * You should have received a copy of the GNU Affero General Public License   *
+ * along with dirtsand.  If not, see <http://www.gnu.org/licenses/>.          *
+ ******************************************************************************/
+
+#ifndef _DS_PQPOOL_H
+#define _DS_PQPOOL_H
+
+#include "pqaccess.h"
+#include <condition_variable>
+#include <vector>
+#include <mutex>
+
+namespace DS
+{
+    /* Bounded pool of postgres connections shared between threads.
+     * Connections are opened on demand up to the limit, after which
+     * callers wait for one to be returned. */
+    class PostgresPool
+    {
+    public:
+        struct Stats
+        {
+            uint64_t m_acquires, m_waits;
+            uint64_t m_totalWaitUsec, m_maxWaitUsec;
+            size_t m_open, m_idle;
+        };
+
+        PostgresPool(size_t maxConnections);
+        ~PostgresPool();
+
+        // Opens up to `count` connections ahead of time
+        void warmup(size_t count);
+
+        PGconn* acquire();
+        void release(PGconn* conn);
+
+        Stats stats();
+
+        /* Returns the borrowed connection to the pool when it goes out of
+         * scope.  Evaluates to nullptr if no connection could be made. */
+        class Lease
+        {
+        public:
+            explicit Lease(PostgresPool* pool)
+                : m_pool(pool), m_conn(pool->acquire()) { }
+            ~Lease() { if (m_conn) m_pool->release(m_conn); }
+
+            operator PGconn*() const { return m_conn; }
+
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+
+        private:
+            PostgresPool* m_pool;
+            PGconn* m_conn;
+        };
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cond;
+        std::vector<PGconn*> m_idle;
+        size_t m_open, m_max;
+        Stats m_stats;
+
+        PGconn* connect();
+    };
+}
+
+#endif
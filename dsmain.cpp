@@ -22,6 +22,7 @@
 #include "FileServ/FileServer.h"
 #include "AuthServ/AuthServer.h"
 #include "GameServ/GameServer.h"
+#include "GameServ/MsgStats.h"
 #include "SDL/DescriptorDb.h"
 #include "errors.h"
 #include "settings.h"
@@ -59,8 +60,9 @@ static char** console_completer(const char* text, int start, int end)
 {
     static const char* completions[] = {
         /* Commands */
-        "addacct", "addallplayers", "clients", "commdebug", "globalsdl", "help", "keygen",
-        "modacct", "quit", "restart", "restrict", "welcome",
+        "addacct", "addallplayers", "clients", "commdebug", "dbpool", "globalsdl", "help",
+        "keygen", "modacct", "msgstats", "quit", "reloadsdl", "restart", "restrict",
+        "upgradesdl", "welcome",
         /* Services */
         "auth", "lobby", "status",
     };
@@ -240,7 +242,7 @@ int main(int argc, char* argv[])
     // Ignore sigpipe and force send() to return EPIPE
     signal(SIGPIPE, SIG_IGN);
 
-    SDL::DescriptorDb::LoadDescriptors(DS::Settings::SdlPath());
+    SDL::DescriptorDb::LoadDescriptors(DS::Settings::SdlPath(), DS::Settings::SdlCache());
     DS::FileServer_Init();
     DS::AuthServer_Init(restrictLogins);
     DS::GameServer_Init();
@@ -324,6 +326,20 @@ int main(int argc, char* argv[])
             DS::FileServer_DisplayClients();
             DS::AuthServer_DisplayClients();
             DS::GameServer_DisplayClients();
+        } else if (args[0] == "dbpool") {
+            DS::GameServer_DisplayDbPool();
+        } else if (args[0] == "msgstats") {
+            if (args.size() == 1) {
+                DS::MsgStats_Display();
+            } else if (args[1] == "on") {
+                DS::MsgStats_SetEnabled(true);
+            } else if (args[1] == "off") {
+                DS::MsgStats_SetEnabled(false);
+            } else if (args[1] == "reset") {
+                DS::MsgStats_Reset();
+            } else {
+                fputs("Usage: msgstats [on|off|reset]\n", stderr);
+            }
         } else if (args[0] == "commdebug") {
 #ifdef DEBUG
             if (args.size() == 1)
@@ -400,19 +416,34 @@ int main(int argc, char* argv[])
                 value = args[3];
             if (!DS::AuthServer_ChangeGlobalSDL(args[1], args[2], value))
                 ST::printf(stderr, "Error: Failed to change variable '{}'\n", args[2]);
+        } else if (args[0] == "reloadsdl") {
+            // Live states pick up the new descriptors as they are next updated
+            if (SDL::DescriptorDb::LoadDescriptors(DS::Settings::SdlPath(), DS::Settings::SdlCache()))
+                ST::printf("Loaded SDL generation {} ({} older generations still in use)\n",
+                           SDL::DescriptorDb::Generation(),
+                           SDL::DescriptorDb::RetainedGenerations());
+            else
+                fputs("Error: Failed to reload SDL descriptors\n", stderr);
+        } else if (args[0] == "upgradesdl") {
+            if (!DS::GameServer_UpgradeSDL())
+                fputs("Error: Some stored SDL states could not be upgraded\n", stderr);
         } else if (args[0] == "help") {
             fputs("DirtSand v1.0 Console supported commands:\n"
                   "    addacct <user> <password>\n"
                   "    addallplayers <playerId>\n"
                   "    clients\n"
                   "    commdebug <on|off>\n"
+                  "    dbpool\n"
                   "    globalsdl <ageName> <variable> <value>\n"
                   "    help\n"
                   "    keygen <new|show>\n"
                   "    modacct <user> [flag]\n"
+                  "    msgstats [on|off|reset]\n"
                   "    quit\n"
+                  "    reloadsdl\n"
                   "    restart <auth|lobby|status> [...]\n"
                   "    restrict\n"
+                  "    upgradesdl\n"
                   "    welcome <message>\n",
                   stdout);
         } else {
@@ -80,11 +80,21 @@ static struct
     /* Data locations */
     ST::string m_fileRoot, m_authRoot;
     ST::string m_sdlPath, m_agePath;
+    ST::string m_sdlCache;
     ST::string m_settingsPath;
 
     /* Database */
     ST::string m_dbHostname, m_dbPort, m_dbUsername, m_dbPassword, m_dbDbase;
 
+    /* Game server tuning */
+    uint32_t m_gameThreads;
+    ST::string m_gameHibernatePath;
+    uint32_t m_gameDbConnections, m_gameDbWarmConnections;
+    bool m_gameCoalesceMovement;
+    bool m_gameMessageStats;
+    uint32_t m_gameCompressThreshold;
+    bool m_gameEnforceCapacity;
+
     /* Misc */
     bool m_statusEnabled;
     ST::string m_welcome;
@@ -168,6 +178,22 @@ bool DS::Settings::LoadFrom(const ST::string& filename)
                 s_settings.m_authServ = params[1].to_utf16();
             } else if (params[0] == "Game.Host") {
                 s_settings.m_gameServ = params[1];
+            } else if (params[0] == "Game.Threads") {
+                s_settings.m_gameThreads = params[1].to_uint(10);
+            } else if (params[0] == "Game.HibernatePath") {
+                s_settings.m_gameHibernatePath = params[1];
+            } else if (params[0] == "Game.DbConnections") {
+                s_settings.m_gameDbConnections = params[1].to_uint(10);
+            } else if (params[0] == "Game.DbWarmConnections") {
+                s_settings.m_gameDbWarmConnections = params[1].to_uint(10);
+            } else if (params[0] == "Game.CoalesceMovement") {
+                s_settings.m_gameCoalesceMovement = params[1].to_bool();
+            } else if (params[0] == "Game.MessageStats") {
+                s_settings.m_gameMessageStats = params[1].to_bool();
+            } else if (params[0] == "Game.CompressThreshold") {
+                s_settings.m_gameCompressThreshold = params[1].to_uint(10);
+            } else if (params[0] == "Game.EnforceCapacity") {
+                s_settings.m_gameEnforceCapacity = params[1].to_bool();
             } else if (params[0] == "Lobby.Addr") {
                 s_settings.m_lobbyAddr = params[1];
             } else if (params[0] == "Lobby.Port") {
@@ -188,6 +214,8 @@ bool DS::Settings::LoadFrom(const ST::string& filename)
                     s_settings.m_authRoot += "/";
             } else if (params[0] == "Sdl.Path") {
                 s_settings.m_sdlPath = params[1];
+            } else if (params[0] == "Sdl.Cache") {
+                s_settings.m_sdlCache = params[1];
             } else if (params[0] == "Age.Path") {
                 s_settings.m_agePath = params[1];
             } else if (params[0] == "Db.Host") {
@@ -221,10 +249,19 @@ void DS::Settings::UseDefaults()
     s_settings.m_lobbyPort = ST_LITERAL("14617");
     s_settings.m_statusPort = ST_LITERAL("8080");
     s_settings.m_statusEnabled = true;
+    s_settings.m_gameThreads = 0;
+    s_settings.m_gameHibernatePath = ST::string();
+    s_settings.m_gameDbConnections = 16;
+    s_settings.m_gameDbWarmConnections = 2;
+    s_settings.m_gameCoalesceMovement = false;
+    s_settings.m_gameMessageStats = false;
+    s_settings.m_gameCompressThreshold = 0;
+    s_settings.m_gameEnforceCapacity = false;
 
     s_settings.m_fileRoot = ST_LITERAL("./data");
     s_settings.m_authRoot = ST_LITERAL("./authdata");
     s_settings.m_sdlPath = ST_LITERAL("./SDL");
+    s_settings.m_sdlCache = ST::string();
     s_settings.m_agePath = ST_LITERAL("./ages");
 
     s_settings.m_dbHostname = ST_LITERAL("localhost");
@@ -260,6 +297,46 @@ ST::string DS::Settings::GameServerAddress()
     return s_settings.m_gameServ;
 }
 
+uint32_t DS::Settings::GameThreads()
+{
+    return s_settings.m_gameThreads;
+}
+
+ST::string DS::Settings::GameHibernatePath()
+{
+    return s_settings.m_gameHibernatePath;
+}
+
+uint32_t DS::Settings::GameDbConnections()
+{
+    return s_settings.m_gameDbConnections;
+}
+
+uint32_t DS::Settings::GameDbWarmConnections()
+{
+    return s_settings.m_gameDbWarmConnections;
+}
+
+bool DS::Settings::GameCoalesceMovement()
+{
+    return s_settings.m_gameCoalesceMovement;
+}
+
+bool DS::Settings::GameMessageStats()
+{
+    return s_settings.m_gameMessageStats;
+}
+
+uint32_t DS::Settings::GameCompressThreshold()
+{
+    return s_settings.m_gameCompressThreshold;
+}
+
+bool DS::Settings::GameEnforceCapacity()
+{
+    return s_settings.m_gameEnforceCapacity;
+}
+
 const char* DS::Settings::LobbyAddress()
 {
     return s_settings.m_lobbyAddr.empty()
@@ -304,6 +381,11 @@ const char* DS::Settings::SdlPath()
     return s_settings.m_sdlPath.c_str();
 }
 
+ST::string DS::Settings::SdlCache()
+{
+    return s_settings.m_sdlCache;
+}
+
 const char* DS::Settings::AgePath()
 {
     return s_settings.m_agePath.c_str();
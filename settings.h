@@ -58,6 +58,28 @@ namespace DS
         ST::utf16_buffer AuthServerAddress();
         ST::string GameServerAddress();
 
+        // Worker threads shared by all game hosts (0 = one per core)
+        uint32_t GameThreads();
+
+        // Directory for snapshots of idle game hosts (empty = disabled)
+        ST::string GameHibernatePath();
+
+        // Postgres connections shared by all game hosts
+        uint32_t GameDbConnections();
+        uint32_t GameDbWarmConnections();
+
+        // Replace queued avatar input updates that haven't been sent yet
+        bool GameCoalesceMovement();
+
+        // Collect per-message-type stats from startup
+        bool GameMessageStats();
+
+        // Compress outgoing game message payloads at least this big (0 = off)
+        uint32_t GameCompressThreshold();
+
+        // Limit age instances to their MaxCapacity, spilling public ages
+        bool GameEnforceCapacity();
+
         const char* LobbyAddress();
         const char* LobbyPort();
 
@@ -71,6 +93,9 @@ namespace DS
         const char* AgePath();
         ST::string SettingsPath();
 
+        // Binary cache of the parsed SDL descriptors (empty = disabled)
+        ST::string SdlCache();
+
         const char* DbHostname();
         const char* DbPort();
         const char* DbUsername();
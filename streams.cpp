@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <memory>
 
 bool DS::Stream::readLine(void* buffer, size_t count)
 {
@@ -42,6 +43,14 @@ bool DS::Stream::readLine(void* buffer, size_t count)
     return outp != buffer;
 }
 
+DS::Blob DS::Stream::readBlob(size_t size)
+{
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[size]);
+    if (readBytes(buffer.get(), size) != static_cast<ssize_t>(size))
+        throw EofException();
+    return Blob::Steal(buffer.release(), size);
+}
+
 ST::string DS::Stream::readString(size_t length, DS::StringType format)
 {
     if (format == e_StringUTF16) {
@@ -97,6 +106,22 @@ ST::string DS::Stream::readSafeString(DS::StringType format)
     }
 }
 
+size_t DS::Stream::readSafeStringBytes(char* buffer)
+{
+    uint16_t length = read<uint16_t>();
+    if (!(length & 0xF000))
+        read<uint16_t>();   // Discarded
+    length &= 0x0FFF;
+
+    if (readBytes(buffer, length) != static_cast<ssize_t>(length))
+        throw EofException();
+    if (length && (buffer[0] & 0x80) != 0) {
+        for (uint16_t i=0; i<length; ++i)
+            buffer[i] = ~buffer[i];
+    }
+    return length;
+}
+
 void DS::Stream::writeString(const ST::string& value, DS::StringType format)
 {
     if (format == e_StringUTF16) {
@@ -237,6 +262,15 @@ ssize_t DS::BlobStream::readBytes(void* buffer, size_t count)
     return count;
 }
 
+DS::Blob DS::BlobStream::readBlob(size_t size)
+{
+    if (m_position + size > m_blob.size())
+        throw EofException();
+    Blob result = m_blob.view(m_position, size);
+    m_position += size;
+    return result;
+}
+
 ssize_t DS::BlobStream::writeBytes(const void* buffer, size_t count)
 {
     throw FileIOException("Cannot write to read-only stream");
@@ -47,6 +47,8 @@ namespace DS
         e_StringRAW8, e_StringUTF8, e_StringUTF16,
     };
 
+    class Blob;
+
     class Stream
     {
     public:
@@ -66,9 +68,18 @@ namespace DS
 
         bool readLine(void* buffer, size_t count);
 
+        /* Read size bytes as a Blob.  Streams over shared memory may
+         * return a view instead of a copy. */
+        virtual Blob readBlob(size_t size);
+
         ST::string readString(size_t length, DS::StringType format = e_StringRAW8);
         ST::string readSafeString(DS::StringType format = e_StringRAW8);
 
+        /* Reads the raw bytes of an 8-bit safe string without allocating.
+         * buffer must hold at least MAX_SAFE_STRING bytes. */
+        static constexpr size_t MAX_SAFE_STRING = 0x0FFF;
+        size_t readSafeStringBytes(char* buffer);
+
         template <typename tp, typename stream_type = tp> void write(tp value)
         {
             auto svalue = static_cast<stream_type>(value);
@@ -191,13 +202,44 @@ namespace DS
         void operator=(const BufferStream& copy) { }
     };
 
+    /* Refcounted storage which any number of Blobs can view into */
+    class SharedBuffer
+    {
+    public:
+        static SharedBuffer* Create(size_t size)
+        {
+            void* storage = ::operator new(sizeof(SharedBuffer) + size);
+            return new (storage) SharedBuffer(size);
+        }
+
+        uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+        size_t size() const { return m_size; }
+
+        void ref() { ++m_refs; }
+        void unref()
+        {
+            if (--m_refs == 0) {
+                this->~SharedBuffer();
+                ::operator delete(this);
+            }
+        }
+
+    private:
+        alignas(16) std::atomic_int m_refs;
+        size_t m_size;
+
+        explicit SharedBuffer(size_t size) : m_refs(1), m_size(size) { }
+        SharedBuffer(const SharedBuffer&) = delete;
+        void operator=(const SharedBuffer&) = delete;
+    };
+
     /* Read-only non-copyable RAM stream */
     class Blob
     {
     public:
-        Blob() noexcept : m_buffer(), m_size() { }
+        Blob() noexcept : m_buffer(), m_size(), m_shared() { }
 
-        Blob(const uint8_t* buffer, size_t size)
+        Blob(const uint8_t* buffer, size_t size) : m_shared()
         {
             auto bufcopy = new uint8_t[size];
             memcpy(bufcopy, buffer, size);
@@ -206,21 +248,28 @@ namespace DS
         }
 
         Blob(Blob&& other) noexcept
-            : m_buffer(other.m_buffer), m_size(other.m_size)
+            : m_buffer(other.m_buffer), m_size(other.m_size),
+              m_shared(other.m_shared)
         {
             other.m_buffer = nullptr;
+            other.m_shared = nullptr;
         }
 
-        ~Blob() noexcept { delete[] m_buffer; }
+        ~Blob() noexcept { release(); }
 
         Blob(const Blob&) = delete;
         Blob& operator=(const Blob&) = delete;
 
         Blob& operator=(Blob&& other) noexcept
         {
+            if (this == &other)
+                return *this;
+            release();
             m_buffer = other.m_buffer;
             m_size = other.m_size;
+            m_shared = other.m_shared;
             other.m_buffer = nullptr;
+            other.m_shared = nullptr;
             return *this;
         }
 
@@ -232,6 +281,34 @@ namespace DS
             return b;
         }
 
+        /* View the whole of a shared buffer, holding a reference to it */
+        static Blob Share(SharedBuffer* shared)
+        {
+            Blob b;
+            shared->ref();
+            b.m_buffer = shared->data();
+            b.m_size = shared->size();
+            b.m_shared = shared;
+            return b;
+        }
+
+        /* A sub-range of this blob.  Shared blobs hand out another view of
+         * the same storage; anything else gets its own copy. */
+        Blob view(size_t offset, size_t size) const
+        {
+            if (!m_shared)
+                return Blob(m_buffer + offset, size);
+
+            Blob b;
+            m_shared->ref();
+            b.m_buffer = m_buffer + offset;
+            b.m_size = size;
+            b.m_shared = m_shared;
+            return b;
+        }
+
+        bool isShared() const { return m_shared != nullptr; }
+
         template <size_t length>
         static Blob FromString(const char (&text)[length])
         {
@@ -250,6 +327,15 @@ namespace DS
     private:
         const uint8_t* m_buffer;
         size_t m_size;
+        SharedBuffer* m_shared;
+
+        void release() noexcept
+        {
+            if (m_shared)
+                m_shared->unref();
+            else
+                delete[] m_buffer;
+        }
     };
 
     class BlobStream : public Stream
@@ -261,6 +347,7 @@ namespace DS
 
         ssize_t readBytes(void* buffer, size_t count) override;
         ssize_t writeBytes(const void* buffer, size_t count) override;
+        Blob readBlob(size_t size) override;
 
         uint32_t tell() const override { return static_cast<uint32_t>(m_position); }
         void seek(int32_t offset, int whence) override;